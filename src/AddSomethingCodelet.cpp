@@ -17,12 +17,17 @@
 
 #include <poplar/Vertex.hpp>
 
+#ifdef __IPU__
+#include <ipudef.h>
+#endif
+
+template <typename T>
 class AddSomething : public poplar::Vertex
 {
 public:
     // Fields.
-    poplar::Input<int> something;
-    poplar::InOut<int> input_output;
+    poplar::Input<T> something;
+    poplar::InOut<T> input_output;
 
     // Compute method.
     bool compute()
@@ -33,3 +38,116 @@ public:
         return true;
     }
 };
+
+template class AddSomething<int>;
+template class AddSomething<float>;
+template class AddSomething<half>;
+template class AddSomething<long long>;
+
+#ifdef __IPU__
+// The 64-bit vector type used to load and store each element type, and the
+// number of elements that it holds.
+template <typename T> struct Packed;
+template <> struct Packed<int>       { using type = int2;      static const unsigned width = 2; };
+template <> struct Packed<float>     { using type = float2;    static const unsigned width = 2; };
+template <> struct Packed<half>      { using type = half4;     static const unsigned width = 4; };
+template <> struct Packed<long long> { using type = long long; static const unsigned width = 1; };
+#endif
+
+template <typename T>
+class AddSomethingVector : public poplar::Vertex
+{
+public:
+    // Fields.
+    poplar::Input<T> something;
+    poplar::InOut<poplar::Vector<T, poplar::VectorLayout::SPAN, 8>> input_output;
+    unsigned num_repeats;
+
+    // Compute method.
+    bool compute()
+    {
+        const T value = something;
+        const unsigned size = input_output.size();
+        unsigned i = 0;
+
+#ifdef __IPU__
+        // Process elements using 64-bit loads and stores, keeping each packed
+        // vector in registers for all of the repeats. (The vector is aligned
+        // to 8 bytes, so this is safe.)
+        using P = typename Packed<T>::type;
+        const unsigned width = Packed<T>::width;
+
+        P *packed = reinterpret_cast<P*>(&input_output[0]);
+        P value_packed;
+        for (unsigned k=0; k<width; ++k)
+        {
+            reinterpret_cast<T*>(&value_packed)[k] = value;
+        }
+
+        for (; i<size/width; ++i)
+        {
+            P x = packed[i];
+            for (unsigned j=0; j<num_repeats; ++j)
+            {
+                x += value_packed;
+            }
+            packed[i] = x;
+        }
+        i *= width;
+#endif
+
+        // Process any remaining elements one at a time.
+        for (; i<size; ++i)
+        {
+            T x = input_output[i];
+            for (unsigned j=0; j<num_repeats; ++j)
+            {
+                x += value;
+            }
+            input_output[i] = x;
+        }
+
+        // All okay!
+        return true;
+    }
+};
+
+template class AddSomethingVector<int>;
+template class AddSomethingVector<float>;
+template class AddSomethingVector<half>;
+template class AddSomethingVector<long long>;
+
+template <typename T>
+class AddSomethingMulti : public poplar::MultiVertex
+{
+public:
+    // Fields.
+    poplar::Input<T> something;
+    poplar::InOut<poplar::Vector<T>> input_output;
+
+    // The number of consecutive elements handled by a worker, so that workers
+    // never write to the same 32-bit word.
+    static const unsigned grain = sizeof(T) < 4 ? 4 / sizeof(T) : 1;
+
+    // Compute method. Grains of elements are interleaved between the workers.
+    bool compute(unsigned workerId)
+    {
+        const unsigned size = input_output.size();
+
+        for (unsigned g=workerId*grain; g<size; g+=numWorkers()*grain)
+        {
+            for (unsigned i=g; i<g+grain and i<size; ++i)
+            {
+                input_output[i] += something;
+            }
+        }
+
+        // All okay!
+        return true;
+    }
+};
+
+template class AddSomethingMulti<int>;
+template class AddSomethingMulti<float>;
+template class AddSomethingMulti<half>;
+template class AddSomethingMulti<long long>;
@@ -0,0 +1,241 @@
+/*
+  Copyright (c) 2022 Lester Hedges <lester.hedges@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _BENCHMARK_RESULTS_HPP
+#define _BENCHMARK_RESULTS_HPP
+
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Quote a string for use in JSON, escaping any special characters. (Control
+// characters other than new lines and tabs aren't expected.)
+inline std::string jsonQuote(const std::string &s)
+{
+    std::string escaped = "\"";
+    for (const auto c : s)
+    {
+        switch (c)
+        {
+            case '"':  escaped += "\\\""; break;
+            case '\\': escaped += "\\\\"; break;
+            case '\n': escaped += "\\n";  break;
+            case '\t': escaped += "\\t";  break;
+            default:   escaped += c;
+        }
+    }
+    return escaped + "\"";
+}
+
+// A table of benchmark results, with one row per configuration, that can be
+// written as CSV or JSON for plotting. Columns should be set in the same
+// order for every row, since the CSV header is taken from the first row.
+class BenchmarkResults
+{
+public:
+    // Start a new row.
+    void addRow();
+
+    // Set a numeric column in the current row. Non-finite values are written
+    // as empty CSV fields and JSON nulls.
+    void setNumber(const std::string &column, double value);
+
+    // Set a string column in the current row.
+    void setString(const std::string &column, const std::string &value);
+
+    // Set a boolean column in the current row.
+    void setFlag(const std::string &column, bool value);
+
+    // Get the number of rows.
+    std::size_t size() const;
+
+    // Write the results to a file. Paths ending in ".json" are written as
+    // JSON, anything else as CSV.
+    void write(const std::string &path) const;
+
+    // Write the results as CSV, with a header row.
+    void writeCsv(std::ostream &os) const;
+
+    // Write the results as a JSON array, with one object per row.
+    void writeJson(std::ostream &os) const;
+
+private:
+    // The kind of value held by a field, which determines how it is written.
+    enum class Kind
+    {
+        NUMBER,
+        STRING,
+        FLAG
+    };
+
+    // A single value in a row.
+    struct Field
+    {
+        std::string column;
+        std::string text;
+        Kind kind;
+    };
+
+    // Add a field to the current row.
+    void set(const std::string &column, const std::string &text, Kind kind);
+
+    // The rows of the table.
+    std::vector<std::vector<Field>> rows;
+};
+
+inline void BenchmarkResults::addRow()
+{
+    this->rows.emplace_back();
+}
+
+inline void BenchmarkResults::setNumber(const std::string &column, double value)
+{
+    std::string text;
+    if (std::isfinite(value))
+    {
+        std::ostringstream ss;
+        ss << std::setprecision(15) << value;
+        text = ss.str();
+    }
+    this->set(column, text, Kind::NUMBER);
+}
+
+inline void BenchmarkResults::setString(const std::string &column, const std::string &value)
+{
+    this->set(column, value, Kind::STRING);
+}
+
+inline void BenchmarkResults::setFlag(const std::string &column, bool value)
+{
+    this->set(column, value ? "true" : "false", Kind::FLAG);
+}
+
+inline std::size_t BenchmarkResults::size() const
+{
+    return this->rows.size();
+}
+
+inline void BenchmarkResults::write(const std::string &path) const
+{
+    std::ofstream file(path);
+    if (not file)
+    {
+        throw std::runtime_error("Unable to write benchmark results: " + path);
+    }
+
+    const std::string extension = ".json";
+    if ((path.size() >= extension.size()) and
+        (path.compare(path.size() - extension.size(), extension.size(), extension) == 0))
+    {
+        this->writeJson(file);
+    }
+    else
+    {
+        this->writeCsv(file);
+    }
+}
+
+inline void BenchmarkResults::writeCsv(std::ostream &os) const
+{
+    if (this->rows.empty())
+    {
+        return;
+    }
+
+    // Quote a field if it contains a separator or a quote.
+    auto escape = [](const std::string &s)
+    {
+        if (s.find_first_of(",\"\n") == std::string::npos)
+        {
+            return s;
+        }
+
+        std::string quoted = "\"";
+        for (const auto c : s)
+        {
+            quoted += c;
+            if (c == '"')
+            {
+                quoted += c;
+            }
+        }
+        return quoted + "\"";
+    };
+
+    const auto &header = this->rows.front();
+    for (unsigned i=0; i<header.size(); ++i)
+    {
+        os << (i > 0 ? "," : "") << escape(header[i].column);
+    }
+    os << '\n';
+
+    for (const auto &row : this->rows)
+    {
+        for (unsigned i=0; i<row.size(); ++i)
+        {
+            os << (i > 0 ? "," : "") << escape(row[i].text);
+        }
+        os << '\n';
+    }
+}
+
+inline void BenchmarkResults::writeJson(std::ostream &os) const
+{
+    os << "[\n";
+    for (unsigned i=0; i<this->rows.size(); ++i)
+    {
+        const auto &row = this->rows[i];
+
+        os << "  {";
+        for (unsigned j=0; j<row.size(); ++j)
+        {
+            const auto &field = row[j];
+
+            os << (j > 0 ? ", " : "") << jsonQuote(field.column) << ": ";
+            if (field.kind == Kind::STRING)
+            {
+                os << jsonQuote(field.text);
+            }
+            else if (field.text.empty())
+            {
+                os << "null";
+            }
+            else
+            {
+                os << field.text;
+            }
+        }
+        os << "}" << (i + 1 < this->rows.size() ? "," : "") << '\n';
+    }
+    os << "]\n";
+}
+
+inline void BenchmarkResults::set(const std::string &column, const std::string &text, Kind kind)
+{
+    if (this->rows.empty())
+    {
+        this->addRow();
+    }
+    this->rows.back().push_back({column, text, kind});
+}
+
+#endif /* _BENCHMARK_RESULTS_HPP */
@@ -0,0 +1,44 @@
+/*
+  Copyright (c) 2022 Lester Hedges <lester.hedges@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <poplar/Vertex.hpp>
+
+// Decrement a loop counter, setting the predicate to whether another
+// iteration should run. This is used as the condition program of a
+// RepeatWhileTrue loop, so that the number of iterations can be written by
+// the host at runtime.
+class CountDown : public poplar::Vertex
+{
+public:
+    // Fields.
+    poplar::InOut<unsigned> counter;
+    poplar::Output<unsigned> predicate;
+
+    // Compute method.
+    bool compute()
+    {
+        const unsigned count = counter;
+        *predicate = (count > 0);
+        if (count > 0)
+        {
+            *counter = count - 1;
+        }
+
+        // All okay!
+        return true;
+    }
+};
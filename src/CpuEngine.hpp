@@ -0,0 +1,295 @@
+/*
+  Copyright (c) 2022 Lester Hedges <lester.hedges@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _CPU_ENGINE_HPP
+#define _CPU_ENGINE_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <type_traits>
+#include <vector>
+
+#include "TaskPool.hpp"
+
+// Note that this file doesn't depend on Poplar, so the CPU engine can be used
+// as a reference on machines without an IPU.
+
+// The type used for the arithmetic on elements of type T. Signed integers wrap
+// around on overflow on the device, but overflow is undefined on the host, so
+// they are operated on as the unsigned type of the same size, which wraps.
+// (The two types may alias each other, so the tensors are used in place.)
+template <typename T, bool = std::is_integral<T>::value>
+struct Arithmetic
+{
+    using type = T;
+};
+
+template <typename T>
+struct Arithmetic<T, true>
+{
+    using type = std::make_unsigned_t<T>;
+};
+
+// A host implementation of the Add -> Multiply -> Sum graph program. The data
+// uses the same layout as the tensors on the IPU, i.e. one element for each
+// worker on each tile, with tensor1 holding a row of num_columns elements for
+// each element of tensor0. Tiles are partitioned between the threads of a
+// pool, and the kernels operate on contiguous, tile-aligned ranges using
+// loops that the compiler can vectorise.
+template <typename T>
+class CpuEngine
+{
+public:
+    // Constructor.
+    //   num_tiles:    The total number of tiles.
+    //   num_workers:  The number of workers per tile.
+    //   num_columns:  The number of columns in tensor1.
+    //   multiply_sum: Whether to fuse the multiply and sum.
+    //   num_threads:  The number of host threads to use.
+    CpuEngine(unsigned num_tiles,
+              unsigned num_workers,
+              unsigned num_columns,
+              bool multiply_sum,
+              unsigned num_threads);
+
+    // Copy the input into tensor0.
+    void copyInput(const T *input);
+
+    // Add something to each element of tensor0, num_repeats times.
+    void add(T something, unsigned num_repeats);
+
+    // Multiply each element of tensor0 by something, writing num_columns
+    // copies to each row of tensor1. (When fused, also perform the sum.)
+    void multiply(T something);
+
+    // Sum each row of tensor1 into tensor0. (A no-op when fused.)
+    void sum();
+
+    // Copy tensor0 to the output.
+    void copyOutput(T *output) const;
+
+    // Get the number of elements in tensor0.
+    std::size_t size() const;
+
+    // Get the number of threads used.
+    unsigned numThreads() const;
+
+private:
+    // The number of tiles and workers per tile.
+    unsigned num_tiles;
+    unsigned num_workers;
+
+    // The number of columns in tensor1.
+    unsigned num_columns;
+
+    // Whether the multiply and sum are fused.
+    bool multiply_sum;
+
+    // The tensors.
+    std::vector<T> tensor0;
+    std::vector<T> tensor1;
+
+    // The thread pool. Each task returns the first tile of its range.
+    TaskPool<std::size_t> pool;
+
+    // The type used for the arithmetic.
+    using U = typename Arithmetic<T>::type;
+
+    // Call fn(begin, end) for contiguous ranges of tensor0 elements covering
+    // whole tiles, in parallel.
+    void forEachTileRange(const std::function<void(std::size_t, std::size_t)> &fn);
+};
+
+template <typename T>
+CpuEngine<T>::CpuEngine(unsigned num_tiles,
+                        unsigned num_workers,
+                        unsigned num_columns,
+                        bool multiply_sum,
+                        unsigned num_threads) :
+    num_tiles(num_tiles),
+    num_workers(num_workers),
+    num_columns(num_columns),
+    multiply_sum(multiply_sum),
+    tensor0(std::size_t(num_tiles) * num_workers),
+    pool(num_threads)
+{
+    if (not multiply_sum)
+    {
+        this->tensor1.resize(this->tensor0.size() * num_columns);
+    }
+}
+
+template <typename T>
+void CpuEngine<T>::copyInput(const T *input)
+{
+    this->forEachTileRange([&](std::size_t begin, std::size_t end)
+    {
+        std::copy(input + begin, input + end, this->tensor0.begin() + begin);
+    });
+}
+
+template <typename T>
+void CpuEngine<T>::add(T something, unsigned num_repeats)
+{
+    // Work on blocks that fit comfortably in cache, so that the repeats don't
+    // need to stream the whole range from memory each time.
+    const std::size_t block_size = 4096;
+    const U value = static_cast<U>(something);
+
+    this->forEachTileRange([&](std::size_t begin, std::size_t end)
+    {
+        for (std::size_t block=begin; block<end; block+=block_size)
+        {
+            U *__restrict x = reinterpret_cast<U*>(this->tensor0.data()) + block;
+            const std::size_t n = std::min(block_size, end - block);
+
+            for (unsigned r=0; r<num_repeats; ++r)
+            {
+                for (std::size_t i=0; i<n; ++i)
+                {
+                    x[i] += value;
+                }
+            }
+        }
+    });
+}
+
+template <typename T>
+void CpuEngine<T>::multiply(T something)
+{
+    const unsigned num_columns = this->num_columns;
+    const U factor = static_cast<U>(something);
+
+    this->forEachTileRange([&](std::size_t begin, std::size_t end)
+    {
+        U *__restrict x = reinterpret_cast<U*>(this->tensor0.data());
+
+        // Fused multiply and sum. Accumulate in the same order as the device
+        // so that the results are identical.
+        if (this->multiply_sum)
+        {
+            for (std::size_t i=begin; i<end; ++i)
+            {
+                const U value = factor * x[i];
+                U sum = 0;
+                for (unsigned j=0; j<num_columns; ++j)
+                {
+                    sum += value;
+                }
+                x[i] = sum;
+            }
+            return;
+        }
+
+        U *__restrict y = reinterpret_cast<U*>(this->tensor1.data());
+        for (std::size_t i=begin; i<end; ++i)
+        {
+            const U value = factor * x[i];
+            std::fill_n(y + i*num_columns, num_columns, value);
+        }
+    });
+}
+
+template <typename T>
+void CpuEngine<T>::sum()
+{
+    if (this->multiply_sum)
+    {
+        return;
+    }
+
+    const unsigned num_columns = this->num_columns;
+
+    this->forEachTileRange([&](std::size_t begin, std::size_t end)
+    {
+        U *__restrict x = reinterpret_cast<U*>(this->tensor0.data());
+        const U *__restrict y = reinterpret_cast<const U*>(this->tensor1.data());
+
+        for (std::size_t i=begin; i<end; ++i)
+        {
+            U sum = 0;
+            for (unsigned j=0; j<num_columns; ++j)
+            {
+                sum += y[i*num_columns + j];
+            }
+            x[i] = sum;
+        }
+    });
+}
+
+template <typename T>
+void CpuEngine<T>::copyOutput(T *output) const
+{
+    std::copy(this->tensor0.begin(), this->tensor0.end(), output);
+}
+
+template <typename T>
+std::size_t CpuEngine<T>::size() const
+{
+    return this->tensor0.size();
+}
+
+template <typename T>
+unsigned CpuEngine<T>::numThreads() const
+{
+    return this->pool.size();
+}
+
+template <typename T>
+void CpuEngine<T>::forEachTileRange(const std::function<void(std::size_t, std::size_t)> &fn)
+{
+    const std::size_t num_workers = this->num_workers;
+
+    // Partition the tiles into a contiguous range for each thread, then
+    // convert to element ranges.
+    const std::size_t num_threads = this->pool.size();
+    const std::size_t chunk = (this->num_tiles + num_threads - 1) / num_threads;
+    unsigned num_tasks = 0;
+    for (std::size_t begin=0; begin<this->num_tiles; begin+=chunk)
+    {
+        const std::size_t end = std::min<std::size_t>(this->num_tiles, begin + chunk);
+        this->pool.submit([&fn, num_workers, begin, end]
+        {
+            fn(begin * num_workers, end * num_workers);
+            return begin;
+        });
+        ++num_tasks;
+    }
+
+    // Wait for every range, since the tasks refer to fn, before rethrowing
+    // any error.
+    std::exception_ptr error;
+    for (unsigned i=0; i<num_tasks; ++i)
+    {
+        try
+        {
+            this->pool.next();
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+    }
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+#endif /* _CPU_ENGINE_HPP */
@@ -0,0 +1,335 @@
+/*
+  Copyright (c) 2022 Lester Hedges <lester.hedges@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _CYCLE_ESTIMATORS_HPP
+#define _CYCLE_ESTIMATORS_HPP
+
+#include <cstdint>
+#include <string>
+
+#include <poplar/Graph.hpp>
+#include <poplar/PerfEstimateFunc.hpp>
+#include <poplar/Target.hpp>
+#include <poplar/VertexIntrospector.hpp>
+
+#include <poputil/VertexTemplates.hpp>
+
+#include "DataType.hpp"
+
+// Cycle estimates for the codelets, derived from the loop structure of their
+// compute methods and the cost of operating on each element type. These are
+// registered with the graph, so that they are used by the IPUModel and for the
+// compile-time estimates, and can be compared with the cycles measured on
+// hardware.
+//
+// A Vertex is estimated in worker cycles, i.e. the instructions issued by the
+// worker thread running it. Each worker issues on one of the time slots of
+// the tile in turn, so when every worker is busy the cycles for a tile are the
+// sum of those of its vertices. A MultiVertex runs on all of the workers at
+// once, so is estimated as the cycles of its busiest worker multiplied by the
+// number of workers, making the estimates for both kinds of vertex additive.
+
+// The number of worker cycles taken by the operations used by the codelets
+// for an element type.
+struct TypeCycles
+{
+    // Scalar loads and stores. (Sub-word stores are a read-modify-write of
+    // the containing word.)
+    unsigned load;
+    unsigned store;
+
+    // Scalar arithmetic. (There are no 64-bit integer instructions, so these
+    // are emulated with 32-bit operations.)
+    unsigned add;
+    unsigned multiply;
+
+    // The number of elements in a 64-bit vector, and the cycles to add two
+    // vectors. (Integers have no vector instructions, so each element is
+    // added separately.)
+    unsigned vector_width;
+    unsigned vector_add;
+
+    // The cost of converting an element to the type used to accumulate it in
+    // a reduction.
+    unsigned widen;
+};
+
+// The fixed cost of running a vertex, i.e. loading the pointers to its fields,
+// along with any setup and return, and the extra cost for a MultiVertex of
+// working out the range of elements for the worker.
+const unsigned vertex_cycles = 8;
+const unsigned multi_vertex_cycles = 6;
+
+// The cost of each iteration of a loop, i.e. the branch and index update.
+const unsigned loop_cycles = 2;
+
+// Get the worker cycles taken by the operations on an element type.
+inline TypeCycles typeCycles(DataType dtype)
+{
+    switch (dtype)
+    {
+        case DataType::FLOAT: return {1, 1, 1, 1, 2, 1, 0};
+        case DataType::HALF:  return {1, 3, 1, 1, 4, 1, 1};
+        case DataType::INT64: return {2, 2, 4, 12, 1, 4, 0};
+        default:              return {1, 1, 1, 1, 2, 2, 0};
+    }
+}
+
+// Get the number of elements processed by the busiest worker of a MultiVertex,
+// when grains of elements are interleaved between the workers. Grains never
+// share a 32-bit word, so sub-word types are processed in pairs.
+inline std::uint64_t busiestWorker(DataType dtype, std::uint64_t size, unsigned num_workers)
+{
+    const std::uint64_t grain = typeSize(dtype) < 4 ? 4 / typeSize(dtype) : 1;
+    const std::uint64_t num_grains = (size + grain - 1) / grain;
+
+    return ((num_grains + num_workers - 1) / num_workers) * grain;
+}
+
+// AddSomething: load, add, and store a single element.
+inline std::uint64_t addSomethingCycles(DataType dtype)
+{
+    const auto c = typeCycles(dtype);
+    return vertex_cycles + 2 * c.load + c.add + c.store;
+}
+
+// AddSomethingVector: each 64-bit vector is loaded, has the value added to it
+// num_repeats times in registers, and is stored. Any remaining elements are
+// processed one at a time.
+inline std::uint64_t addSomethingVectorCycles(
+        DataType dtype,
+        std::uint64_t size,
+        unsigned num_repeats)
+{
+    const auto c = typeCycles(dtype);
+    const auto num_vectors = size / c.vector_width;
+    const auto num_remaining = size % c.vector_width;
+
+    return vertex_cycles + c.load
+         + num_vectors * (c.load + c.store + loop_cycles
+                          + std::uint64_t(num_repeats) * (c.vector_add + loop_cycles))
+         + num_remaining * (c.load + c.store + loop_cycles
+                            + std::uint64_t(num_repeats) * (c.add + loop_cycles));
+}
+
+// AddSomethingMulti: each worker loads, adds to, and stores its elements.
+inline std::uint64_t addSomethingMultiCycles(
+        DataType dtype,
+        std::uint64_t size,
+        unsigned num_workers)
+{
+    const auto c = typeCycles(dtype);
+    const auto worker_cycles = vertex_cycles + multi_vertex_cycles + c.load
+        + busiestWorker(dtype, size, num_workers) * (c.load + c.add + c.store + loop_cycles);
+
+    return num_workers * worker_cycles;
+}
+
+// MultiplySomethingNumTimes: store the product of two elements num times. (The
+// product is recomputed on each iteration.)
+inline std::uint64_t multiplySomethingNumTimesCycles(DataType dtype, unsigned num)
+{
+    const auto c = typeCycles(dtype);
+    return vertex_cycles + 2 * c.load
+         + std::uint64_t(num) * (c.multiply + c.store + loop_cycles);
+}
+
+// MultiplySomethingNumTimesMulti: each worker computes the product for each of
+// its rows once, then stores it num times.
+inline std::uint64_t multiplySomethingNumTimesMultiCycles(
+        DataType dtype,
+        std::uint64_t size,
+        unsigned num,
+        unsigned num_workers)
+{
+    const auto c = typeCycles(dtype);
+    const auto worker_cycles = vertex_cycles + multi_vertex_cycles + c.load
+        + busiestWorker(dtype, size, num_workers)
+          * (c.load + c.multiply + loop_cycles + std::uint64_t(num) * (c.store + loop_cycles));
+
+    return num_workers * worker_cycles;
+}
+
+// Sum: accumulate num elements in a register, then store the result.
+inline std::uint64_t sumCycles(DataType dtype, unsigned num)
+{
+    const auto c = typeCycles(dtype);
+    return vertex_cycles + c.store
+         + std::uint64_t(num) * (c.load + c.add + loop_cycles);
+}
+
+// SumMulti: each worker accumulates num elements for each of its rows.
+inline std::uint64_t sumMultiCycles(
+        DataType dtype,
+        std::uint64_t size,
+        unsigned num,
+        unsigned num_workers)
+{
+    const auto c = typeCycles(dtype);
+    const auto worker_cycles = vertex_cycles + multi_vertex_cycles
+        + busiestWorker(dtype, size, num_workers)
+          * (c.store + loop_cycles + std::uint64_t(num) * (c.load + c.add + loop_cycles));
+
+    return num_workers * worker_cycles;
+}
+
+// MultiplySum: compute a product, then accumulate it num times in a register.
+inline std::uint64_t multiplySumCycles(DataType dtype, unsigned num)
+{
+    const auto c = typeCycles(dtype);
+    return vertex_cycles + 2 * c.load + c.multiply + c.store
+         + std::uint64_t(num) * (c.add + loop_cycles);
+}
+
+// MultiplySumMulti: each worker computes and accumulates the product for each
+// of its elements.
+inline std::uint64_t multiplySumMultiCycles(
+        DataType dtype,
+        std::uint64_t size,
+        unsigned num,
+        unsigned num_workers)
+{
+    const auto c = typeCycles(dtype);
+    const auto worker_cycles = vertex_cycles + multi_vertex_cycles + c.load
+        + busiestWorker(dtype, size, num_workers)
+          * (c.load + c.multiply + c.store + loop_cycles
+             + std::uint64_t(num) * (c.add + loop_cycles));
+
+    return num_workers * worker_cycles;
+}
+
+// Reduce: widen and accumulate each element, then store the result. (Halves
+// are accumulated as floats, and integers with the same cost as their type.)
+inline std::uint64_t reduceCycles(DataType dtype, std::uint64_t size)
+{
+    const auto c = typeCycles(dtype);
+    return vertex_cycles + c.store
+         + size * (c.load + c.widen + c.add + loop_cycles);
+}
+
+// CountDown: load and test the counter, then store it and the predicate.
+inline std::uint64_t countDownCycles()
+{
+    const auto c = typeCycles(DataType::INT);
+    return vertex_cycles + c.load + 2 * c.store + 2;
+}
+
+// Register the cycle estimators for every codelet with a graph. These read the
+// sizes and initial values of the fields of each vertex, so that the estimates
+// track the amount of work it does.
+inline void registerCycleEstimators(poplar::Graph &graph)
+{
+    using poplar::VertexIntrospector;
+    using poplar::VertexPerfEstimate;
+    using poplar::Target;
+
+    for (const auto dtype : {DataType::INT, DataType::FLOAT, DataType::HALF, DataType::INT64})
+    {
+        const auto type = poplarType(dtype);
+        auto name = [&type](const std::string &codelet)
+        {
+            return poputil::templateVertex(codelet, type);
+        };
+
+        graph.registerPerfEstimator(name("AddSomething"),
+            [dtype](const VertexIntrospector &, const Target &)
+            {
+                return VertexPerfEstimate(addSomethingCycles(dtype));
+            });
+
+        graph.registerPerfEstimator(name("AddSomethingVector"),
+            [dtype](const VertexIntrospector &v, const Target &target)
+            {
+                return VertexPerfEstimate(addSomethingVectorCycles(dtype,
+                    v.getFieldInfo("input_output").size(),
+                    v.getFieldInfo("num_repeats").getInitialValue<unsigned>(target)));
+            });
+
+        graph.registerPerfEstimator(name("AddSomethingMulti"),
+            [dtype](const VertexIntrospector &v, const Target &target)
+            {
+                return VertexPerfEstimate(addSomethingMultiCycles(dtype,
+                    v.getFieldInfo("input_output").size(),
+                    target.getNumWorkerContexts()));
+            });
+
+        graph.registerPerfEstimator(name("MultiplySomethingNumTimes"),
+            [dtype](const VertexIntrospector &v, const Target &)
+            {
+                return VertexPerfEstimate(multiplySomethingNumTimesCycles(dtype,
+                    v.getFieldInfo("output").size()));
+            });
+
+        graph.registerPerfEstimator(name("MultiplySomethingNumTimesMulti"),
+            [dtype](const VertexIntrospector &v, const Target &target)
+            {
+                const auto size = v.getFieldInfo("input").size();
+                return VertexPerfEstimate(multiplySomethingNumTimesMultiCycles(dtype,
+                    size,
+                    size > 0 ? v.getFieldInfo("output").size() / size : 0,
+                    target.getNumWorkerContexts()));
+            });
+
+        graph.registerPerfEstimator(name("Sum"),
+            [dtype](const VertexIntrospector &v, const Target &)
+            {
+                return VertexPerfEstimate(sumCycles(dtype,
+                    v.getFieldInfo("input").size()));
+            });
+
+        graph.registerPerfEstimator(name("SumMulti"),
+            [dtype](const VertexIntrospector &v, const Target &target)
+            {
+                const auto size = v.getFieldInfo("output").size();
+                return VertexPerfEstimate(sumMultiCycles(dtype,
+                    size,
+                    size > 0 ? v.getFieldInfo("input").size() / size : 0,
+                    target.getNumWorkerContexts()));
+            });
+
+        graph.registerPerfEstimator(name("MultiplySum"),
+            [dtype](const VertexIntrospector &v, const Target &target)
+            {
+                return VertexPerfEstimate(multiplySumCycles(dtype,
+                    v.getFieldInfo("num").getInitialValue<unsigned>(target)));
+            });
+
+        graph.registerPerfEstimator(name("MultiplySumMulti"),
+            [dtype](const VertexIntrospector &v, const Target &target)
+            {
+                return VertexPerfEstimate(multiplySumMultiCycles(dtype,
+                    v.getFieldInfo("input_output").size(),
+                    v.getFieldInfo("num").getInitialValue<unsigned>(target),
+                    target.getNumWorkerContexts()));
+            });
+
+        graph.registerPerfEstimator(name("Reduce"),
+            [dtype](const VertexIntrospector &v, const Target &)
+            {
+                return VertexPerfEstimate(reduceCycles(dtype,
+                    v.getFieldInfo("input").size()));
+            });
+    }
+
+    graph.registerPerfEstimator("CountDown",
+        [](const VertexIntrospector &, const Target &)
+        {
+            return VertexPerfEstimate(countDownCycles());
+        });
+}
+
+#endif /* _CYCLE_ESTIMATORS_HPP */
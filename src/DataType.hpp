@@ -0,0 +1,237 @@
+/*
+  Copyright (c) 2022 Lester Hedges <lester.hedges@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _DATA_TYPE_HPP
+#define _DATA_TYPE_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <poplar/Target.hpp>
+#include <poplar/Type.hpp>
+
+// The element types supported by the codelets.
+enum class DataType
+{
+    INT,
+    FLOAT,
+    HALF,
+    INT64
+};
+
+// Convert a name, e.g. "float", to a data type. Returns false if the name
+// isn't recognised.
+inline bool parseDataType(const std::string &name, DataType &dtype)
+{
+    if (name == "int")        dtype = DataType::INT;
+    else if (name == "float") dtype = DataType::FLOAT;
+    else if (name == "half")  dtype = DataType::HALF;
+    else if (name == "int64") dtype = DataType::INT64;
+    else return false;
+
+    return true;
+}
+
+// Get the name of a data type.
+inline std::string dataTypeName(DataType dtype)
+{
+    switch (dtype)
+    {
+        case DataType::FLOAT: return "float";
+        case DataType::HALF:  return "half";
+        case DataType::INT64: return "int64";
+        default:              return "int";
+    }
+}
+
+// Get the Poplar type corresponding to a data type.
+inline poplar::Type poplarType(DataType dtype)
+{
+    switch (dtype)
+    {
+        case DataType::FLOAT: return poplar::FLOAT;
+        case DataType::HALF:  return poplar::HALF;
+        case DataType::INT64: return poplar::LONGLONG;
+        default:              return poplar::INT;
+    }
+}
+
+// Get the NumPy type descriptor of a data type, as used in the header of a
+// .npy file. (Elements are stored little-endian, as on the device.)
+inline std::string npyDescr(DataType dtype)
+{
+    switch (dtype)
+    {
+        case DataType::FLOAT: return "<f4";
+        case DataType::HALF:  return "<f2";
+        case DataType::INT64: return "<i8";
+        default:              return "<i4";
+    }
+}
+
+// Get the size of an element in bytes. (This is the same on the host and the
+// device.)
+inline std::size_t typeSize(DataType dtype)
+{
+    switch (dtype)
+    {
+        case DataType::HALF:  return 2;
+        case DataType::INT64: return 8;
+        default:              return 4;
+    }
+}
+
+// Round a value to the nearest value representable by the data type, i.e.
+// emulate the result of a device arithmetic operation. An int wraps around on
+// overflow, and floating point values use round-to-nearest-even. An int64 is
+// returned unchanged, since a double can't hold every int64, so it is only
+// exact up to 2^53. (Use wrapToType to emulate integer arithmetic exactly.)
+inline double roundToType(DataType dtype, double x)
+{
+    switch (dtype)
+    {
+        case DataType::INT:
+            return static_cast<std::int32_t>(
+                static_cast<std::uint32_t>(static_cast<std::int64_t>(x)));
+
+        case DataType::FLOAT:
+            return static_cast<float>(x);
+
+        case DataType::HALF:
+        {
+            if (std::isnan(x) or std::isinf(x))
+            {
+                return x;
+            }
+
+            // Values at or beyond halfway between the largest half (65504)
+            // and the next power of two overflow to infinity.
+            const double a = std::fabs(x);
+            if (a >= 65520.0)
+            {
+                return std::copysign(std::numeric_limits<double>::infinity(), x);
+            }
+
+            // Halves have 11 significant bits, with a fixed spacing of 2^-24
+            // for subnormals. (std::nearbyint rounds to nearest-even.)
+            int e;
+            std::frexp(a, &e);
+            const double ulp = std::ldexp(1.0, std::max(e - 11, -24));
+            return std::copysign(std::nearbyint(a / ulp) * ulp, x);
+        }
+
+        default:
+            return x;
+    }
+}
+
+// Wrap the result of integer arithmetic on the host, done in unsigned 64-bit
+// arithmetic, which wraps modulo 2^64, around to the range of an integer data
+// type, i.e. emulate the result of a device operation on int or int64.
+inline std::int64_t wrapToType(DataType dtype, std::uint64_t x)
+{
+    if (dtype == DataType::INT)
+    {
+        return static_cast<std::int32_t>(static_cast<std::uint32_t>(x));
+    }
+
+    return static_cast<std::int64_t>(x);
+}
+
+// Fill a host buffer with n copies of a value, in the format that the device
+// expects for the data type.
+inline void fillBuffer(
+        DataType dtype,
+        const poplar::Target &target,
+        void *p,
+        std::size_t n,
+        double value)
+{
+    switch (dtype)
+    {
+        case DataType::INT:
+            std::fill_n(static_cast<int*>(p), n, static_cast<int>(value));
+            break;
+
+        case DataType::FLOAT:
+            std::fill_n(static_cast<float*>(p), n, static_cast<float>(value));
+            break;
+
+        case DataType::HALF:
+        {
+            const std::vector<float> values(n, static_cast<float>(value));
+            poplar::copyFloatToDeviceHalf(target, values.data(), p, n);
+            break;
+        }
+
+        case DataType::INT64:
+            std::fill_n(static_cast<long long*>(p), n, static_cast<long long>(value));
+            break;
+    }
+}
+
+// Convert n elements of a host buffer in the device format for the data type
+// to doubles.
+inline std::vector<double> readBuffer(
+        DataType dtype,
+        const poplar::Target &target,
+        const void *p,
+        std::size_t n)
+{
+    std::vector<double> values(n);
+
+    switch (dtype)
+    {
+        case DataType::INT:
+        {
+            const auto q = static_cast<const int*>(p);
+            std::copy(q, q + n, values.begin());
+            break;
+        }
+
+        case DataType::FLOAT:
+        {
+            const auto q = static_cast<const float*>(p);
+            std::copy(q, q + n, values.begin());
+            break;
+        }
+
+        case DataType::HALF:
+        {
+            std::vector<float> floats(n);
+            poplar::copyDeviceHalfToFloat(target, p, floats.data(), n);
+            std::copy(floats.begin(), floats.end(), values.begin());
+            break;
+        }
+
+        case DataType::INT64:
+        {
+            const auto q = static_cast<const long long*>(p);
+            std::copy(q, q + n, values.begin());
+            break;
+        }
+    }
+
+    return values;
+}
+
+#endif /* _DATA_TYPE_HPP */
@@ -0,0 +1,187 @@
+/*
+  Copyright (c) 2022 Lester Hedges <lester.hedges@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _EXECUTABLE_CACHE_HPP
+#define _EXECUTABLE_CACHE_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <poplar/Executable.hpp>
+
+// A simple on-disk cache of compiled graph programs.
+//
+// Entries are stored as "<config>-<sources>.poplar_exe", where <config> is a
+// hash of everything that determines the graph topology and its compilation
+// (Poplar version, target, number of IPUs and tiles, compile options, etc.)
+// and <sources> is a hash of the source files that the executable is built
+// from, i.e. the codelets and the host code that builds the graph. Changing
+// any of these gives a new key, and entries for the same configuration that
+// were built from older sources are removed the next time an executable is
+// stored.
+class ExecutableCache
+{
+public:
+    // Constructor.
+    //   directory: The directory in which to store cached executables.
+    //   config:    A description of the graph and its compilation options.
+    //   sources:   The paths to the source files that build the graph, i.e.
+    //              the codelets and the host code.
+    ExecutableCache(const std::string &directory,
+                    const std::string &config,
+                    const std::vector<std::string> &sources);
+
+    // Try to load a cached executable. Returns an empty optional if there is
+    // no entry for the current key, or if the entry couldn't be read.
+    std::optional<poplar::Executable> load() const;
+
+    // Serialise an executable to the cache, removing stale entries for the
+    // same configuration. This is safe to call concurrently from several
+    // threads, e.g. when compiling different configurations in parallel.
+    void store(const poplar::Executable &executable) const;
+
+    // Get the path of the cache entry for the current key.
+    const std::string& getPath() const;
+
+private:
+    // 64-bit FNV-1a hash of a string, returned as a hexadecimal string.
+    static std::string hash(const std::string &s);
+
+    // The cache directory.
+    std::string directory;
+
+    // The configuration hash, used as the entry prefix.
+    std::string config_hash;
+
+    // The full path to the cache entry.
+    std::string path;
+};
+
+inline ExecutableCache::ExecutableCache(const std::string &directory,
+                                        const std::string &config,
+                                        const std::vector<std::string> &sources) :
+    directory(directory)
+{
+    // Concatenate the source file names and contents.
+    std::string text;
+    for (const auto &source : sources)
+    {
+        std::ifstream file(source, std::ios::binary);
+        if (not file)
+        {
+            throw std::runtime_error("Unable to read source file: " + source);
+        }
+
+        std::ostringstream contents;
+        contents << file.rdbuf();
+
+        text += source + '\n' + contents.str();
+    }
+
+    this->config_hash = hash(config);
+    this->path = (std::filesystem::path(directory) /
+                  (this->config_hash + "-" + hash(text) + ".poplar_exe")).string();
+}
+
+inline std::optional<poplar::Executable> ExecutableCache::load() const
+{
+    std::ifstream file(this->path, std::ios::binary);
+    if (not file)
+    {
+        return std::nullopt;
+    }
+
+    try
+    {
+        return poplar::Executable::deserialize(file);
+    }
+    // The entry is corrupt, or was written by an incompatible Poplar version.
+    // Remove it so that it is regenerated.
+    catch (...)
+    {
+        file.close();
+        std::error_code ec;
+        std::filesystem::remove(this->path, ec);
+        return std::nullopt;
+    }
+}
+
+inline void ExecutableCache::store(const poplar::Executable &executable) const
+{
+    std::filesystem::create_directories(this->directory);
+
+    // Remove entries for this configuration that were built from different
+    // sources. (Temporary files belong to writers that are still
+    // running, so are left alone.)
+    std::error_code ec;
+    const auto prefix = this->config_hash + "-";
+    for (const auto &entry : std::filesystem::directory_iterator(this->directory, ec))
+    {
+        const auto name = entry.path().filename().string();
+        if ((name.rfind(prefix, 0) == 0) and
+            (name.find(".tmp") == std::string::npos) and
+            (entry.path().string() != this->path))
+        {
+            std::filesystem::remove(entry.path(), ec);
+        }
+    }
+
+    // Write to a temporary file first, then rename, so that an interrupted
+    // run never leaves a truncated entry behind. The file name is unique to
+    // the thread, so concurrent writers of the same entry don't collide.
+    const auto tmp_path = this->path + ".tmp." +
+        std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+    {
+        std::ofstream file(tmp_path, std::ios::binary);
+        if (not file)
+        {
+            throw std::runtime_error("Unable to write to executable cache: " + tmp_path);
+        }
+        executable.serialize(file);
+    }
+    std::filesystem::rename(tmp_path, this->path);
+}
+
+inline const std::string& ExecutableCache::getPath() const
+{
+    return this->path;
+}
+
+inline std::string ExecutableCache::hash(const std::string &s)
+{
+    std::uint64_t h = 14695981039346656037ull;
+    for (const unsigned char c : s)
+    {
+        h ^= c;
+        h *= 1099511628211ull;
+    }
+
+    std::ostringstream ss;
+    ss << std::hex << std::setw(16) << std::setfill('0') << h;
+    return ss.str();
+}
+
+#endif /* _EXECUTABLE_CACHE_HPP */
@@ -0,0 +1,339 @@
+/*
+  Copyright (c) 2022 Lester Hedges <lester.hedges@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _HOST_STREAMS_HPP
+#define _HOST_STREAMS_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <condition_variable>
+#include <cstddef>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <poplar/StreamCallback.hpp>
+
+// A pair of fixed-size host buffers used to pass batches between a host
+// thread and the Poplar stream callbacks. While one buffer is being read
+// the other can be written, so host-side preparation (or consumption) of a
+// batch overlaps with the transfer and processing of the previous one.
+class DoubleBuffer
+{
+public:
+    // Constructor.
+    //   num_bytes: The size of a single batch in bytes.
+    DoubleBuffer(std::size_t num_bytes);
+
+    // Get the next free buffer to write to, blocking until one is available.
+    // Returns nullptr if the buffer has been closed.
+    void* acquireWrite();
+
+    // Mark the buffer returned by acquireWrite as full.
+    void releaseWrite();
+
+    // Get the next full buffer to read from, blocking until one is available.
+    // Returns nullptr if the buffer has been closed and no full buffers are
+    // left. If skip is set, the oldest full buffers are skipped, so that a
+    // reader can hold on to them until they are released.
+    const void* acquireRead(unsigned skip = 0);
+
+    // Non-blocking version of acquireRead. Returns nullptr if no buffer is
+    // full.
+    const void* tryAcquireRead(unsigned skip = 0);
+
+    // Mark the oldest full buffer as free.
+    void releaseRead();
+
+    // Close the buffer, e.g. because the device has stopped, waking any
+    // threads that are waiting to read or write. Full buffers can still be
+    // read, but no more can be written.
+    void close();
+
+    // Get the size of a batch in bytes.
+    std::size_t size() const;
+
+private:
+    // The buffers.
+    std::vector<char> buffers[2];
+
+    // The number of bytes in a batch.
+    std::size_t num_bytes;
+
+    // The index of the next buffer to write to and read from.
+    unsigned write_index = 0;
+    unsigned read_index = 0;
+
+    // The number of full buffers.
+    unsigned num_full = 0;
+
+    // Whether the buffer has been closed.
+    bool closed = false;
+
+    // Synchronisation primitives.
+    std::mutex mutex;
+    std::condition_variable cv;
+};
+
+// A stream callback that feeds a host-to-device FIFO from a DoubleBuffer.
+// Implementing prefetch allows Poplar to fetch the next batch while the
+// device is still computing on the current one. Poplar may discard prefetched
+// batches, and may prefetch a batch before the previous transfer is complete,
+// so the buffer of each transfer is held until complete() is called for it,
+// oldest first. The buffers of invalidated batches are left full, so they are
+// read again by the next fetch.
+class DoubleBufferInputCallback : public poplar::StreamCallback
+{
+public:
+    DoubleBufferInputCallback(DoubleBuffer &buffer) : buffer(buffer) {}
+
+    Result prefetch(void *p) override
+    {
+        // Both buffers may already be held.
+        if (this->transfers.size() == 2)
+        {
+            return Result::NotAvailable;
+        }
+        const auto src = this->buffer.tryAcquireRead(this->transfers.size());
+        if (src == nullptr)
+        {
+            return Result::NotAvailable;
+        }
+        std::memcpy(p, src, this->buffer.size());
+        this->transfers.push_back(true);
+
+        return Result::Success;
+    }
+
+    void fetch(void *p) override
+    {
+        assert(this->transfers.size() < 2);
+        const auto src = this->buffer.acquireRead(this->transfers.size());
+        if (src == nullptr)
+        {
+            return;
+        }
+        std::memcpy(p, src, this->buffer.size());
+        this->transfers.push_back(false);
+    }
+
+    void complete() override
+    {
+        if (not this->transfers.empty())
+        {
+            this->buffer.releaseRead();
+            this->transfers.pop_front();
+        }
+    }
+
+    void invalidatePrefetched() override
+    {
+        while (not this->transfers.empty() and this->transfers.back())
+        {
+            this->transfers.pop_back();
+        }
+    }
+
+private:
+    DoubleBuffer &buffer;
+
+    // The transfers whose buffers are held until they are complete, oldest
+    // first, and whether each was prefetched.
+    std::deque<bool> transfers;
+};
+
+// A stream callback that feeds a host-to-device FIFO with consecutive chunks
+// of an input of num_bytes. Each chunk is produced by a read function, which
+// is passed the destination, the offset of the chunk in the input, and its
+// size, so it can copy the chunk straight from a block of host memory, e.g. a
+// memory-mapped file, or generate it in place. If the input isn't a whole
+// number of chunks, the last one is padded with zeros.
+class ChunkInputCallback : public poplar::StreamCallback
+{
+public:
+    using ReadFunction = std::function<void(char*, std::size_t, std::size_t)>;
+
+    ChunkInputCallback(std::size_t num_bytes, std::size_t chunk_bytes, ReadFunction read) :
+        num_bytes(num_bytes), chunk_bytes(chunk_bytes), read(std::move(read)) {}
+
+    // The input is always available, so the next chunk can always be
+    // prefetched. Poplar may discard prefetched chunks, and may prefetch a
+    // chunk before the previous transfer is complete, so the size of each
+    // transfer is kept until complete() is called for it, oldest first, to
+    // roll back the position if the prefetched chunks are invalidated.
+    Result prefetch(void *p) override
+    {
+        this->transfers.emplace_back(this->next(p), true);
+        return Result::Success;
+    }
+
+    void fetch(void *p) override
+    {
+        this->transfers.emplace_back(this->next(p), false);
+    }
+
+    void complete() override
+    {
+        if (not this->transfers.empty())
+        {
+            this->transfers.pop_front();
+        }
+    }
+
+    void invalidatePrefetched() override
+    {
+        while (not this->transfers.empty() and this->transfers.back().second)
+        {
+            this->position -= this->transfers.back().first;
+            this->transfers.pop_back();
+        }
+    }
+
+private:
+    // Copy the next chunk into p, returning the number of bytes of the input
+    // that it holds.
+    std::size_t next(void *p)
+    {
+        const auto n = std::min(this->chunk_bytes, this->num_bytes - this->position);
+        this->read(static_cast<char*>(p), this->position, n);
+        std::memset(static_cast<char*>(p) + n, 0, this->chunk_bytes - n);
+        this->position += n;
+
+        return n;
+    }
+
+    std::size_t num_bytes;
+    std::size_t chunk_bytes;
+    ReadFunction read;
+
+    // The offset of the next chunk.
+    std::size_t position = 0;
+
+    // The size of each transfer that isn't yet complete, oldest first, and
+    // whether it was prefetched.
+    std::deque<std::pair<std::size_t, bool>> transfers;
+};
+
+// A callback for a device-to-host FIFO that receives consecutive chunks of an
+// output of num_bytes. Each chunk is passed to a write function, along with
+// its offset in the output and its size, which drops any padding beyond the
+// end of the output. The function can copy the chunk straight into a block
+// of host memory, e.g. a memory-mapped file, or consume it in place.
+class ChunkOutputCallback
+{
+public:
+    using WriteFunction = std::function<void(const char*, std::size_t, std::size_t)>;
+
+    ChunkOutputCallback(std::size_t num_bytes, std::size_t chunk_bytes, WriteFunction write) :
+        num_bytes(num_bytes), chunk_bytes(chunk_bytes), write(std::move(write)) {}
+
+    void operator()(void *p)
+    {
+        const auto n = std::min(this->chunk_bytes, this->num_bytes - this->position);
+        this->write(static_cast<const char*>(p), this->position, n);
+        this->position += n;
+    }
+
+private:
+    std::size_t num_bytes;
+    std::size_t chunk_bytes;
+    WriteFunction write;
+
+    // The offset of the next chunk.
+    std::size_t position = 0;
+};
+
+inline DoubleBuffer::DoubleBuffer(std::size_t num_bytes) :
+    num_bytes(num_bytes)
+{
+    this->buffers[0].resize(num_bytes);
+    this->buffers[1].resize(num_bytes);
+}
+
+inline void* DoubleBuffer::acquireWrite()
+{
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->cv.wait(lock, [this]{ return this->closed or (this->num_full < 2); });
+    if (this->closed)
+    {
+        return nullptr;
+    }
+
+    return this->buffers[this->write_index].data();
+}
+
+inline void DoubleBuffer::releaseWrite()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->write_index ^= 1;
+        ++this->num_full;
+    }
+    this->cv.notify_all();
+}
+
+inline const void* DoubleBuffer::acquireRead(unsigned skip)
+{
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->cv.wait(lock, [this, skip]{ return this->closed or (this->num_full > skip); });
+    if (this->num_full <= skip)
+    {
+        return nullptr;
+    }
+
+    return this->buffers[(this->read_index + skip) % 2].data();
+}
+
+inline const void* DoubleBuffer::tryAcquireRead(unsigned skip)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->num_full <= skip)
+    {
+        return nullptr;
+    }
+
+    return this->buffers[(this->read_index + skip) % 2].data();
+}
+
+inline void DoubleBuffer::releaseRead()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->read_index ^= 1;
+        --this->num_full;
+    }
+    this->cv.notify_all();
+}
+
+inline void DoubleBuffer::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->closed = true;
+    }
+    this->cv.notify_all();
+}
+
+inline std::size_t DoubleBuffer::size() const
+{
+    return this->num_bytes;
+}
+
+#endif /* _HOST_STREAMS_HPP */
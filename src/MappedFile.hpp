@@ -0,0 +1,423 @@
+/*
+  Copyright (c) 2022 Lester Hedges <lester.hedges@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _MAPPED_FILE_HPP
+#define _MAPPED_FILE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A binary file mapped into memory, so that its contents can be streamed to
+// and from the device without reading them into an intermediate buffer. Files
+// ending in ".npy" are NumPy arrays, where the data follows a header giving
+// its type and shape. Anything else is treated as raw data.
+class MappedFile
+{
+public:
+    // Map an existing file for reading.
+    static MappedFile openRead(const std::string &path);
+
+    // Create a file with room for num_bytes of data and map it for writing,
+    // replacing any existing file. For a NumPy array, the header is written
+    // with the given type descriptor, shape, and order.
+    static MappedFile create(
+            const std::string &path,
+            std::size_t num_bytes,
+            const std::string &descr,
+            const std::vector<std::size_t> &shape,
+            bool fortran_order = false);
+
+    // Move constructor.
+    MappedFile(MappedFile &&other) noexcept;
+
+    // Destructor. Unmaps and closes the file.
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile& operator=(MappedFile&&) = delete;
+
+    // Get a pointer to the start of the data.
+    const char* data() const;
+    char* data();
+
+    // Get the size of the data in bytes, excluding any header.
+    std::size_t size() const;
+
+    // Whether the file is a NumPy array.
+    bool isNpy() const;
+
+    // Get the NumPy type descriptor, shape, and order of the array. (Only
+    // valid for a NumPy array.)
+    const std::string& descr() const;
+    const std::vector<std::size_t>& shape() const;
+    bool fortranOrder() const;
+
+    // Get the path of the file.
+    const std::string& getPath() const;
+
+    // Flush any changes to the file, blocking until they are written.
+    void sync();
+
+private:
+    // Constructor.
+    MappedFile() = default;
+
+    // Whether a path has the NumPy extension.
+    static bool hasNpyExtension(const std::string &path);
+
+    // Format a NumPy (version 1.0) header, padded so that the data is aligned
+    // to 64 bytes.
+    static std::string formatNpyHeader(
+            const std::string &descr,
+            const std::vector<std::size_t> &shape,
+            bool fortran_order);
+
+    // Parse the NumPy header at the start of the mapping, setting the offset
+    // of the data, and check that the shape matches the size of the data.
+    void parseNpyHeader();
+
+    // The path of the file, its descriptor, and the mapping of the whole file.
+    std::string path;
+    int fd = -1;
+    char *mapping = nullptr;
+    std::size_t mapping_size = 0;
+
+    // The offset of the data from the start of the file.
+    std::size_t offset = 0;
+
+    // The NumPy header.
+    bool is_npy = false;
+    std::string type_descr;
+    std::vector<std::size_t> array_shape;
+    bool is_fortran_order = false;
+};
+
+inline MappedFile MappedFile::openRead(const std::string &path)
+{
+    MappedFile file;
+    file.path = path;
+    file.is_npy = hasNpyExtension(path);
+
+    file.fd = ::open(path.c_str(), O_RDONLY);
+    struct stat info;
+    if ((file.fd < 0) or (::fstat(file.fd, &info) != 0))
+    {
+        throw std::runtime_error("Unable to open file: " + path);
+    }
+    if (info.st_size == 0)
+    {
+        throw std::runtime_error("File is empty: " + path);
+    }
+    file.mapping_size = info.st_size;
+
+    void *p = ::mmap(nullptr, file.mapping_size, PROT_READ, MAP_PRIVATE, file.fd, 0);
+    if (p == MAP_FAILED)
+    {
+        throw std::runtime_error("Unable to map file: " + path);
+    }
+    file.mapping = static_cast<char*>(p);
+
+    // The data is streamed from start to end, so ask for aggressive
+    // read-ahead.
+    ::madvise(file.mapping, file.mapping_size, MADV_SEQUENTIAL);
+
+    if (file.is_npy)
+    {
+        file.parseNpyHeader();
+    }
+
+    return file;
+}
+
+inline MappedFile MappedFile::create(
+        const std::string &path,
+        std::size_t num_bytes,
+        const std::string &descr,
+        const std::vector<std::size_t> &shape,
+        bool fortran_order)
+{
+    MappedFile file;
+    file.path = path;
+    file.is_npy = hasNpyExtension(path);
+
+    std::string header;
+    if (file.is_npy)
+    {
+        header = formatNpyHeader(descr, shape, fortran_order);
+        file.type_descr = descr;
+        file.array_shape = shape;
+        file.is_fortran_order = fortran_order;
+    }
+    file.offset = header.size();
+    file.mapping_size = header.size() + num_bytes;
+
+    // Size the file up front, so that the whole of it can be mapped. (The
+    // pages are only allocated on disk as they are written.)
+    file.fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if ((file.fd < 0) or (::ftruncate(file.fd, file.mapping_size) != 0))
+    {
+        throw std::runtime_error("Unable to create file: " + path);
+    }
+
+    void *p = ::mmap(nullptr, file.mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, file.fd, 0);
+    if (p == MAP_FAILED)
+    {
+        throw std::runtime_error("Unable to map file: " + path);
+    }
+    file.mapping = static_cast<char*>(p);
+    ::madvise(file.mapping, file.mapping_size, MADV_SEQUENTIAL);
+
+    std::memcpy(file.mapping, header.data(), header.size());
+
+    return file;
+}
+
+inline MappedFile::MappedFile(MappedFile &&other) noexcept :
+    path(std::move(other.path)),
+    fd(std::exchange(other.fd, -1)),
+    mapping(std::exchange(other.mapping, nullptr)),
+    mapping_size(std::exchange(other.mapping_size, 0)),
+    offset(other.offset),
+    is_npy(other.is_npy),
+    type_descr(std::move(other.type_descr)),
+    array_shape(std::move(other.array_shape)),
+    is_fortran_order(other.is_fortran_order)
+{
+}
+
+inline MappedFile::~MappedFile()
+{
+    if (this->mapping != nullptr)
+    {
+        ::munmap(this->mapping, this->mapping_size);
+    }
+    if (this->fd >= 0)
+    {
+        ::close(this->fd);
+    }
+}
+
+inline const char* MappedFile::data() const
+{
+    return this->mapping + this->offset;
+}
+
+inline char* MappedFile::data()
+{
+    return this->mapping + this->offset;
+}
+
+inline std::size_t MappedFile::size() const
+{
+    return this->mapping_size - this->offset;
+}
+
+inline bool MappedFile::isNpy() const
+{
+    return this->is_npy;
+}
+
+inline const std::string& MappedFile::descr() const
+{
+    return this->type_descr;
+}
+
+inline const std::vector<std::size_t>& MappedFile::shape() const
+{
+    return this->array_shape;
+}
+
+inline bool MappedFile::fortranOrder() const
+{
+    return this->is_fortran_order;
+}
+
+inline const std::string& MappedFile::getPath() const
+{
+    return this->path;
+}
+
+inline void MappedFile::sync()
+{
+    if (::msync(this->mapping, this->mapping_size, MS_SYNC) != 0)
+    {
+        throw std::runtime_error("Unable to write file: " + this->path);
+    }
+}
+
+inline bool MappedFile::hasNpyExtension(const std::string &path)
+{
+    const std::string extension = ".npy";
+    return (path.size() >= extension.size()) and
+           (path.compare(path.size() - extension.size(), extension.size(), extension) == 0);
+}
+
+inline std::string MappedFile::formatNpyHeader(
+        const std::string &descr,
+        const std::vector<std::size_t> &shape,
+        bool fortran_order)
+{
+    // The shape is a Python tuple, so a single dimension needs a trailing
+    // comma.
+    std::string dims;
+    for (const auto dim : shape)
+    {
+        dims += std::to_string(dim) + ", ";
+    }
+    if (shape.size() > 1)
+    {
+        dims.erase(dims.size() - 2);
+    }
+    else if (shape.size() == 1)
+    {
+        dims.pop_back();
+    }
+
+    std::string dict = "{'descr': '" + descr + "', 'fortran_order': "
+                     + (fortran_order ? "True" : "False")
+                     + ", 'shape': (" + dims + "), }";
+
+    // The magic string, version, and header length take 10 bytes, and the
+    // header ends with a new line.
+    const std::size_t prefix_size = 10;
+    const std::size_t total = prefix_size + dict.size() + 1;
+    dict.append((64 - total % 64) % 64, ' ');
+    dict += '\n';
+
+    std::string header = "\x93NUMPY";
+    header += char(1);
+    header += char(0);
+    header += char(dict.size() & 0xff);
+    header += char((dict.size() >> 8) & 0xff);
+
+    return header + dict;
+}
+
+inline void MappedFile::parseNpyHeader()
+{
+    auto invalid = [this](const std::string &reason)
+    {
+        return std::runtime_error("Invalid NumPy file (" + reason + "): " + this->path);
+    };
+
+    const auto p = reinterpret_cast<const unsigned char*>(this->mapping);
+    if ((this->mapping_size < 10) or (std::memcmp(p, "\x93NUMPY", 6) != 0))
+    {
+        throw invalid("missing magic string");
+    }
+
+    // Version 1 has a 16-bit header length, and later versions 32-bit.
+    std::size_t header_size;
+    if (p[6] == 1)
+    {
+        header_size = p[8] | (std::size_t(p[9]) << 8);
+        this->offset = 10 + header_size;
+    }
+    else
+    {
+        if (this->mapping_size < 12)
+        {
+            throw invalid("truncated header");
+        }
+        header_size = p[8] | (std::size_t(p[9]) << 8) |
+                      (std::size_t(p[10]) << 16) | (std::size_t(p[11]) << 24);
+        this->offset = 12 + header_size;
+    }
+    if (this->offset > this->mapping_size)
+    {
+        throw invalid("truncated header");
+    }
+    const std::string dict(this->mapping + this->offset - header_size, header_size);
+
+    // Find the value of a key in the header dictionary.
+    auto value = [&](const std::string &key)
+    {
+        auto pos = dict.find("'" + key + "':");
+        if (pos != std::string::npos)
+        {
+            pos = dict.find_first_not_of(' ', pos + key.size() + 3);
+        }
+        if (pos == std::string::npos)
+        {
+            throw invalid("missing '" + key + "'");
+        }
+        return pos;
+    };
+
+    auto pos = value("descr");
+    const auto end = dict.find('\'', pos + 1);
+    if ((dict[pos] != '\'') or (end == std::string::npos))
+    {
+        throw invalid("bad 'descr'");
+    }
+    this->type_descr = dict.substr(pos + 1, end - pos - 1);
+
+    // The descriptor ends with the size of an element in bytes, e.g. "<f4".
+    const auto size_digit = this->type_descr.find_first_of("0123456789");
+    if (size_digit == std::string::npos)
+    {
+        throw invalid("bad 'descr'");
+    }
+    const std::size_t item_size = std::stoull(this->type_descr.substr(size_digit));
+
+    this->is_fortran_order = (dict.compare(value("fortran_order"), 4, "True") == 0);
+
+    // Read each of the dimensions in the shape tuple.
+    pos = value("shape");
+    const auto close = dict.find(')', pos);
+    if ((dict[pos] != '(') or (close == std::string::npos))
+    {
+        throw invalid("bad 'shape'");
+    }
+    const auto dims = dict.substr(pos + 1, close - pos - 1);
+    for (std::size_t i=0; i<dims.size(); )
+    {
+        const auto digit = dims.find_first_of("0123456789", i);
+        if (digit == std::string::npos)
+        {
+            break;
+        }
+        std::size_t length;
+        this->array_shape.push_back(std::stoull(dims.substr(digit), &length));
+        i = digit + length;
+    }
+
+    // The data must hold exactly the elements of the array, so a truncated
+    // or padded file isn't streamed with the wrong shape.
+    std::size_t num_bytes = item_size;
+    for (const auto dim : this->array_shape)
+    {
+        num_bytes *= dim;
+    }
+    if (num_bytes != this->size())
+    {
+        throw invalid("data doesn't match 'shape'");
+    }
+}
+
+#endif /* _MAPPED_FILE_HPP */
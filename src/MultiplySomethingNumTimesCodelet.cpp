@@ -17,13 +17,14 @@
 
 #include <poplar/Vertex.hpp>
 
+template <typename T>
 class MultiplySomethingNumTimes : public poplar::Vertex
 {
 public:
     // Fields.
-    poplar::Input<int> something;
-    poplar::Input<int> input;
-    poplar::Output<poplar::Vector<int>> output;
+    poplar::Input<T> something;
+    poplar::Input<T> input;
+    poplar::Output<poplar::Vector<T>> output;
 
     // Compute method.
     bool compute()
@@ -37,3 +38,50 @@ public:
         return true;
     }
 };
+
+template class MultiplySomethingNumTimes<int>;
+template class MultiplySomethingNumTimes<float>;
+template class MultiplySomethingNumTimes<half>;
+template class MultiplySomethingNumTimes<long long>;
+
+template <typename T>
+class MultiplySomethingNumTimesMulti : public poplar::MultiVertex
+{
+public:
+    // Fields.
+    poplar::Input<T> something;
+    poplar::Input<poplar::Vector<T>> input;
+    poplar::Output<poplar::Vector<T>> output;
+
+    // The number of consecutive rows handled by a worker, so that workers
+    // never write to the same 32-bit word.
+    static const unsigned grain = sizeof(T) < 4 ? 4 / sizeof(T) : 1;
+
+    // Compute method. Each input element has a contiguous row of outputs, and
+    // grains of rows are interleaved between the workers.
+    bool compute(unsigned workerId)
+    {
+        const unsigned size = input.size();
+        const unsigned num = output.size() / size;
+
+        for (unsigned g=workerId*grain; g<size; g+=numWorkers()*grain)
+        {
+            for (unsigned i=g; i<g+grain and i<size; ++i)
+            {
+                const T value = something * input[i];
+                for (unsigned j=0; j<num; ++j)
+                {
+                    output[i*num + j] = value;
+                }
+            }
+        }
+
+        // All okay!
+        return true;
+    }
+};
+
+template class MultiplySomethingNumTimesMulti<int>;
+template class MultiplySomethingNumTimesMulti<float>;
+template class MultiplySomethingNumTimesMulti<half>;
+template class MultiplySomethingNumTimesMulti<long long>;
@@ -0,0 +1,96 @@
+/*
+  Copyright (c) 2022 Lester Hedges <lester.hedges@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <poplar/Vertex.hpp>
+
+// A fused version of MultiplySomethingNumTimes and Sum. Rather than writing
+// num copies of the product to memory and summing them back, the copies are
+// accumulated in a register. The order of operations is unchanged, so the
+// result is identical to the unfused algorithms.
+template <typename T>
+class MultiplySum : public poplar::Vertex
+{
+public:
+    // Fields.
+    poplar::Input<T> something;
+    poplar::InOut<T> input_output;
+    unsigned num;
+
+    // Compute method.
+    bool compute()
+    {
+        const T value = something * input_output;
+
+        T sum = 0;
+        for (unsigned i=0; i<num; ++i)
+        {
+            sum += value;
+        }
+        *input_output = sum;
+
+        // All okay!
+        return true;
+    }
+};
+
+template class MultiplySum<int>;
+template class MultiplySum<float>;
+template class MultiplySum<half>;
+template class MultiplySum<long long>;
+
+template <typename T>
+class MultiplySumMulti : public poplar::MultiVertex
+{
+public:
+    // Fields.
+    poplar::Input<T> something;
+    poplar::InOut<poplar::Vector<T>> input_output;
+    unsigned num;
+
+    // The number of consecutive elements handled by a worker, so that workers
+    // never write to the same 32-bit word.
+    static const unsigned grain = sizeof(T) < 4 ? 4 / sizeof(T) : 1;
+
+    // Compute method. Grains of elements are interleaved between the workers.
+    bool compute(unsigned workerId)
+    {
+        const unsigned size = input_output.size();
+
+        for (unsigned g=workerId*grain; g<size; g+=numWorkers()*grain)
+        {
+            for (unsigned i=g; i<g+grain and i<size; ++i)
+            {
+                const T value = something * input_output[i];
+
+                T sum = 0;
+                for (unsigned j=0; j<num; ++j)
+                {
+                    sum += value;
+                }
+                input_output[i] = sum;
+            }
+        }
+
+        // All okay!
+        return true;
+    }
+};
+
+template class MultiplySumMulti<int>;
+template class MultiplySumMulti<float>;
+template class MultiplySumMulti<half>;
+template class MultiplySumMulti<long long>;
@@ -0,0 +1,236 @@
+/*
+  Copyright (c) 2022 Lester Hedges <lester.hedges@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _PERFORMANCE_REPORT_HPP
+#define _PERFORMANCE_REPORT_HPP
+
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "BenchmarkResults.hpp"
+
+// A structured report of a single run, written as JSON so that it can be
+// compared between runs, e.g. to catch memory or cycle regressions. The report
+// is made up of named sections, written in the order in which they are first
+// used. A section is either a single object, e.g. the configuration, or a
+// list of objects, e.g. one for each phase of the graph program.
+class PerformanceReport
+{
+public:
+    // Set a numeric value in a section. Non-finite values are written as
+    // nulls. If the section is a list, the value is set in its last entry.
+    void setNumber(const std::string &section, const std::string &key, double value);
+
+    // Set a string value in a section.
+    void setString(const std::string &section, const std::string &key, const std::string &value);
+
+    // Set a boolean value in a section.
+    void setFlag(const std::string &section, const std::string &key, bool value);
+
+    // Set an array of numbers in a section.
+    void setNumbers(
+            const std::string &section,
+            const std::string &key,
+            const std::vector<double> &values);
+
+    // Start a new entry in a list section.
+    void addEntry(const std::string &section);
+
+    // Write the report to a JSON file.
+    void write(const std::string &path) const;
+
+    // Write the report as a JSON object, with one member per section.
+    void writeJson(std::ostream &os) const;
+
+private:
+    // A single value, holding either a string or the JSON text of a number,
+    // boolean or array.
+    struct Field
+    {
+        std::string key;
+        std::string text;
+        bool is_string;
+    };
+
+    // A named section, holding one entry for an object, or any number for a
+    // list.
+    struct Section
+    {
+        std::string name;
+        bool is_list;
+        std::vector<std::vector<Field>> entries;
+    };
+
+    // Format a number as JSON.
+    static std::string formatNumber(double value);
+
+    // Get a section, creating it if it doesn't exist.
+    Section &getSection(const std::string &name, bool is_list);
+
+    // Add a field to the last entry of a section.
+    void set(const std::string &section, const std::string &key, const std::string &text, bool is_string);
+
+    // The sections of the report.
+    std::vector<Section> sections;
+};
+
+inline void PerformanceReport::setNumber(
+        const std::string &section,
+        const std::string &key,
+        double value)
+{
+    this->set(section, key, formatNumber(value), false);
+}
+
+inline void PerformanceReport::setString(
+        const std::string &section,
+        const std::string &key,
+        const std::string &value)
+{
+    this->set(section, key, value, true);
+}
+
+inline void PerformanceReport::setFlag(
+        const std::string &section,
+        const std::string &key,
+        bool value)
+{
+    this->set(section, key, value ? "true" : "false", false);
+}
+
+inline void PerformanceReport::setNumbers(
+        const std::string &section,
+        const std::string &key,
+        const std::vector<double> &values)
+{
+    std::string text = "[";
+    for (unsigned i=0; i<values.size(); ++i)
+    {
+        text += (i > 0 ? ", " : "") + formatNumber(values[i]);
+    }
+    this->set(section, key, text + "]", false);
+}
+
+inline void PerformanceReport::addEntry(const std::string &section)
+{
+    this->getSection(section, true).entries.emplace_back();
+}
+
+inline void PerformanceReport::write(const std::string &path) const
+{
+    std::ofstream file(path);
+    if (not file)
+    {
+        throw std::runtime_error("Unable to write performance report: " + path);
+    }
+
+    this->writeJson(file);
+}
+
+inline void PerformanceReport::writeJson(std::ostream &os) const
+{
+    // Write the fields of an entry as a JSON object on a single line.
+    auto write_entry = [&os](const std::vector<Field> &entry)
+    {
+        os << "{";
+        for (unsigned i=0; i<entry.size(); ++i)
+        {
+            const auto &field = entry[i];
+            os << (i > 0 ? ", " : "") << jsonQuote(field.key) << ": "
+               << (field.is_string ? jsonQuote(field.text) : field.text);
+        }
+        os << "}";
+    };
+
+    os << "{\n";
+    for (unsigned i=0; i<this->sections.size(); ++i)
+    {
+        const auto &section = this->sections[i];
+
+        os << "  " << jsonQuote(section.name) << ": ";
+        if (section.is_list)
+        {
+            os << "[\n";
+            for (unsigned j=0; j<section.entries.size(); ++j)
+            {
+                os << "    ";
+                write_entry(section.entries[j]);
+                os << (j + 1 < section.entries.size() ? "," : "") << '\n';
+            }
+            os << "  ]";
+        }
+        else
+        {
+            write_entry(section.entries.front());
+        }
+        os << (i + 1 < this->sections.size() ? "," : "") << '\n';
+    }
+    os << "}\n";
+}
+
+inline std::string PerformanceReport::formatNumber(double value)
+{
+    if (not std::isfinite(value))
+    {
+        return "null";
+    }
+
+    std::ostringstream ss;
+    ss << std::setprecision(15) << value;
+    return ss.str();
+}
+
+inline PerformanceReport::Section &PerformanceReport::getSection(const std::string &name, bool is_list)
+{
+    for (auto &section : this->sections)
+    {
+        if (section.name == name)
+        {
+            return section;
+        }
+    }
+
+    // Objects have a single entry, whereas lists start empty.
+    this->sections.push_back({name, is_list, {}});
+    if (not is_list)
+    {
+        this->sections.back().entries.emplace_back();
+    }
+    return this->sections.back();
+}
+
+inline void PerformanceReport::set(
+        const std::string &section,
+        const std::string &key,
+        const std::string &text,
+        bool is_string)
+{
+    auto &entries = this->getSection(section, false).entries;
+    if (entries.empty())
+    {
+        entries.emplace_back();
+    }
+    entries.back().push_back({key, text, is_string});
+}
+
+#endif /* _PERFORMANCE_REPORT_HPP */
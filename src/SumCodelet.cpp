@@ -17,12 +17,13 @@
 
 #include <poplar/Vertex.hpp>
 
+template <typename T>
 class Sum : public poplar::Vertex
 {
 public:
     // Fields.
-    poplar::Input<poplar::Vector<int>> input;
-    poplar::Output<int> output;
+    poplar::Input<poplar::Vector<T>> input;
+    poplar::Output<T> output;
 
     // Compute method.
     bool compute()
@@ -40,3 +41,89 @@ public:
         return true;
     }
 };
+
+template class Sum<int>;
+template class Sum<float>;
+template class Sum<half>;
+template class Sum<long long>;
+
+template <typename T>
+class SumMulti : public poplar::MultiVertex
+{
+public:
+    // Fields.
+    poplar::Input<poplar::Vector<T>> input;
+    poplar::Output<poplar::Vector<T>> output;
+
+    // The number of consecutive outputs handled by a worker, so that workers
+    // never write to the same 32-bit word.
+    static const unsigned grain = sizeof(T) < 4 ? 4 / sizeof(T) : 1;
+
+    // Compute method. Each output element is the sum of a contiguous row of
+    // inputs, and grains of rows are interleaved between the workers.
+    bool compute(unsigned workerId)
+    {
+        const unsigned size = output.size();
+        const unsigned num = input.size() / size;
+
+        for (unsigned g=workerId*grain; g<size; g+=numWorkers()*grain)
+        {
+            for (unsigned i=g; i<g+grain and i<size; ++i)
+            {
+                T sum = 0;
+                for (unsigned j=0; j<num; ++j)
+                {
+                    sum += input[i*num + j];
+                }
+                output[i] = sum;
+            }
+        }
+
+        // All okay!
+        return true;
+    }
+};
+
+template class SumMulti<int>;
+template class SumMulti<float>;
+template class SumMulti<half>;
+template class SumMulti<long long>;
+
+// The type used to accumulate a reduction for each element type. Integers are
+// accumulated as unsigned so that they wrap around, rather than overflowing,
+// when reducing very large numbers of elements, and halves are accumulated at
+// single precision.
+template <typename T> struct Accumulator          { using type = T; };
+template <> struct Accumulator<int>              { using type = unsigned; };
+template <> struct Accumulator<long long>        { using type = unsigned long long; };
+template <> struct Accumulator<half>             { using type = float; };
+
+template <typename T>
+class Reduce : public poplar::Vertex
+{
+public:
+    // Fields.
+    poplar::Input<poplar::Vector<T>> input;
+    poplar::Output<T> output;
+
+    // Compute method.
+    bool compute()
+    {
+        using A = typename Accumulator<T>::type;
+
+        A sum = 0;
+        for (unsigned i=0; i<input.size(); ++i)
+        {
+            sum += static_cast<A>(input[i]);
+        }
+        *output = static_cast<T>(sum);
+
+        // All okay!
+        return true;
+    }
+};
+
+template class Reduce<int>;
+template class Reduce<float>;
+template class Reduce<half>;
+template class Reduce<long long>;
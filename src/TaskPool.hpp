@@ -0,0 +1,229 @@
+/*
+  Copyright (c) 2022 Lester Hedges <lester.hedges@gmail.com>
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _TASK_POOL_HPP
+#define _TASK_POOL_HPP
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// A bounded pool of threads that runs independent tasks returning a value of
+// type T, e.g. compiling the graph program for several configurations, or the
+// ranges of a data-parallel loop in the CPU engine. Tasks are started in the
+// order they are submitted, at most num_threads at a time, and their results
+// are collected in the order in which they complete, so the caller can make
+// use of the first result while the others are still running.
+// The number of results held by the pool can be bounded, for results that
+// hold a lot of memory, in which case tasks are only started while there is
+// room for their results.
+template <typename T>
+class TaskPool
+{
+public:
+    // Constructor.
+    //   num_threads: The maximum number of tasks to run concurrently.
+    //   max_results: The maximum number of results that are either being
+    //                produced by running tasks or waiting to be collected.
+    TaskPool(unsigned num_threads,
+             unsigned max_results = std::numeric_limits<unsigned>::max());
+
+    // Destructor. Tasks that haven't started are discarded, and running
+    // tasks are waited for.
+    ~TaskPool();
+
+    // Submit a task, returning its index. Indices count up from zero in the
+    // order in which tasks are submitted.
+    unsigned submit(std::function<T()> task);
+
+    // Block until the next task completes, returning its index and result.
+    // If the task threw an exception, it is rethrown here.
+    std::pair<unsigned, T> next();
+
+    // Get the number of tasks whose results haven't yet been collected.
+    unsigned numPending() const;
+
+    // Get the number of threads in the pool.
+    unsigned size() const;
+
+private:
+    // The loop run by each thread.
+    void work();
+
+    // A completed task, holding either its result or the exception it threw.
+    struct Completed
+    {
+        unsigned index;
+        std::optional<T> result;
+        std::exception_ptr error;
+    };
+
+    // The threads.
+    std::vector<std::thread> threads;
+
+    // Tasks that are waiting to start, and those that have completed.
+    std::deque<std::pair<unsigned, std::function<T()>>> queued;
+    std::deque<Completed> completed;
+
+    // The number of tasks submitted, and the number collected.
+    unsigned num_submitted = 0;
+    unsigned num_collected = 0;
+
+    // The number of running tasks, and the maximum number of results.
+    unsigned num_running = 0;
+    unsigned max_results;
+
+    // Whether the pool is shutting down.
+    bool stop = false;
+
+    // Synchronisation primitives.
+    mutable std::mutex mutex;
+    std::condition_variable queued_cv;
+    std::condition_variable completed_cv;
+};
+
+template <typename T>
+TaskPool<T>::TaskPool(unsigned num_threads, unsigned max_results) :
+    max_results(std::max(1u, max_results))
+{
+    num_threads = std::max(1u, num_threads);
+    for (unsigned i=0; i<num_threads; ++i)
+    {
+        this->threads.emplace_back(&TaskPool::work, this);
+    }
+}
+
+template <typename T>
+TaskPool<T>::~TaskPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stop = true;
+        this->queued.clear();
+    }
+    this->queued_cv.notify_all();
+
+    for (auto &thread : this->threads)
+    {
+        thread.join();
+    }
+}
+
+template <typename T>
+unsigned TaskPool<T>::submit(std::function<T()> task)
+{
+    unsigned index;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        index = this->num_submitted++;
+        this->queued.emplace_back(index, std::move(task));
+    }
+    this->queued_cv.notify_one();
+
+    return index;
+}
+
+template <typename T>
+std::pair<unsigned, T> TaskPool<T>::next()
+{
+    std::unique_lock<std::mutex> lock(this->mutex);
+    if (this->num_collected == this->num_submitted)
+    {
+        throw std::logic_error("No tasks are pending!");
+    }
+    this->completed_cv.wait(lock, [this]{ return not this->completed.empty(); });
+
+    auto task = std::move(this->completed.front());
+    this->completed.pop_front();
+    ++this->num_collected;
+    lock.unlock();
+
+    // There is now room for another result.
+    this->queued_cv.notify_one();
+
+    if (task.error)
+    {
+        std::rethrow_exception(task.error);
+    }
+
+    return {task.index, std::move(*task.result)};
+}
+
+template <typename T>
+unsigned TaskPool<T>::numPending() const
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->num_submitted - this->num_collected;
+}
+
+template <typename T>
+unsigned TaskPool<T>::size() const
+{
+    return this->threads.size();
+}
+
+template <typename T>
+void TaskPool<T>::work()
+{
+    while (true)
+    {
+        std::pair<unsigned, std::function<T()>> task;
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->queued_cv.wait(lock, [this]
+            {
+                return this->stop or (not this->queued.empty() and
+                    (this->num_running + this->completed.size() < this->max_results));
+            });
+            if (this->stop)
+            {
+                return;
+            }
+            task = std::move(this->queued.front());
+            this->queued.pop_front();
+            ++this->num_running;
+        }
+
+        Completed result{task.first, std::nullopt, nullptr};
+        try
+        {
+            result.result.emplace(task.second());
+        }
+        catch (...)
+        {
+            result.error = std::current_exception();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            --this->num_running;
+            this->completed.push_back(std::move(result));
+        }
+        this->completed_cv.notify_all();
+    }
+}
+
+#endif /* _TASK_POOL_HPP */
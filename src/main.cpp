@@ -15,338 +15,4004 @@
   along with this program. If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
+#include <cctype>
+#include <cassert>
 #include <chrono>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <exception>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iomanip>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
 #include <vector>
 
+#include <sys/resource.h>
+
+#include <poplar/CycleCount.hpp>
 #include <poplar/DeviceManager.hpp>
 #include <poplar/Engine.hpp>
 #include <poplar/Graph.hpp>
 #include <poplar/IPUModel.hpp>
 
-#include <poputil/TileMapping.hpp>
+#include <gcl/Collectives.hpp>
+
+#include <popops/codelets.hpp>
+
+#include <pva/pva.hpp>
+
+#include <poputil/TileMapping.hpp>
+#include <poputil/VertexTemplates.hpp>
+
+#include "BenchmarkResults.hpp"
+#include "CpuEngine.hpp"
+#include "CycleEstimators.hpp"
+#include "DataType.hpp"
+#include "ExecutableCache.hpp"
+#include "HostStreams.hpp"
+#include "MappedFile.hpp"
+#include "PerformanceReport.hpp"
+#include "TaskPool.hpp"
+
+// Handy enum to name our programs.
+enum Program
+{
+    COPY_TO_IPU,
+    ADD_SOMETHING,
+    MULTIPLY_SOMETHING_NUM_TIMES,
+    SUM,
+    COPY_FROM_IPU,
+    STREAM_BATCHES,
+    FUSED,
+    REDUCE,
+    ADD_STATIC
+};
+
+// The phases of the graph program. Each is timed using on-device cycle
+// stamps on every tile, which can be read back from the host using the
+// handle "<phase>_cycles" (or "fused_<phase>_cycles" for the fused program).
+const std::vector<std::string> phase_names = {
+    "copy_input",
+    "add",
+    "multiply",
+    "sum",
+    "copy_output"
+};
+
+// The vertex layout used for the algorithms.
+enum class VertexLayout
+{
+    // One vertex per element.
+    SCALAR,
+    // One AddSomething vertex per worker, operating on a contiguous range of
+    // elements and running the repeats inside the vertex.
+    VECTOR,
+    // One MultiVertex per tile for each algorithm, with the elements on the
+    // tile split between the workers.
+    MULTI
+};
+
+// The strategy used to map tensor0 and tensor1 to the tiles.
+enum class MappingStrategy
+{
+    // Map each tensor independently using poputil::mapTensorLinearly.
+    LINEAR,
+    // Map a block of one element per worker to each tile, with the rows of
+    // tensor1 on the same tile as the corresponding elements of tensor0.
+    WORKER,
+    // Spread whole 64-bit grains of tensor0 evenly amongst the tiles, with
+    // the rows of tensor1 following the elements of tensor0.
+    GRAIN
+};
+
+// Where the constants used by the algorithms are placed.
+enum class ConstantPlacement
+{
+    // A single copy on tile 0, which every other tile fetches over the
+    // exchange.
+    TILE0,
+    // A copy on every tile, so that each vertex reads its constant locally.
+    PER_TILE
+};
+
+// Options that determine the structure of the graph program.
+struct GraphOptions
+{
+    // The number of IPUs.
+    unsigned num_ipus;
+
+    // The total number of tiles.
+    unsigned num_tiles;
+
+    // The number of replicas of the graph. When greater than one, the graph
+    // for num_ipus / num_replicas IPUs is compiled once and replicated, and
+    // num_ipus and num_tiles count the totals across all replicas.
+    unsigned num_replicas = 1;
+
+    // The number of worker threads per tile.
+    unsigned num_workers;
+
+    // The number of elements of tensor0 for each worker on every tile. This
+    // is only greater than one when streaming chunks of an input that is
+    // larger than the device.
+    unsigned elements_per_worker = 1;
+
+    // The number of columns in tensor1, i.e. the number of copies of each
+    // element that are made by the multiply and then summed.
+    unsigned num_columns = 20;
+
+    // The number of times to repeat the addition.
+    unsigned num_repeats = 100;
+
+    // The values that are added and multiplied by the algorithms.
+    double add_value = 5;
+    double multiply_value = 10;
+
+    // Whether the values are device variables that are written by the host
+    // at runtime, rather than constants that are compiled into the graph.
+    // This allows a single executable to be used for many sets of values.
+    bool runtime_values = false;
+
+    // Whether the number of repeats is a device variable that is written by
+    // the host at runtime, rather than being compiled into the graph.
+    bool runtime_repeats = false;
+
+    // The number of batches to stream through the device. If zero, the
+    // streaming program isn't built.
+    unsigned num_batches = 0;
+
+    // Whether to build the fused program.
+    bool fused = false;
+
+    // The vertex layout.
+    VertexLayout vertices = VertexLayout::SCALAR;
+
+    // The tile mapping strategy.
+    MappingStrategy mapping = MappingStrategy::LINEAR;
+
+    // The placement of the constants.
+    ConstantPlacement constants = ConstantPlacement::TILE0;
+
+    // Whether to build the global tree reduction of tensor0.
+    bool reduce = false;
+
+    // The element type of the tensors.
+    DataType dtype = DataType::INT;
+
+    // Whether to fuse the multiply and sum into a single MultiplySum vertex,
+    // avoiding the need to store tensor1.
+    bool multiply_sum = false;
+};
+
+// The fan-in of each level of the tree reduction within an IPU.
+const unsigned reduction_fan_in = 8;
+
+// The number of iterations of the static Repeat loop used to calibrate the
+// loop overhead when the number of repeats is written at runtime.
+const unsigned static_repeats = 16;
+
+// The fraction of the memory of each tile that is filled by the tensors and
+// vertex state for a chunk, when streaming an input that is larger than the
+// device. (The rest is left for code, stacks, and exchange and stream
+// buffers.)
+const double chunk_memory_fraction = 0.5;
+
+// The approximate size in bytes of the state of a vertex, used to size the
+// chunks for vertex layouts with vertices for each element.
+const unsigned vertex_state_bytes = 32;
+
+// Options that determine the device used to run the graph program.
+struct DeviceOptions
+{
+    // The backend: "hw" for IPU hardware, "model" for an IPUModel, or "cpu"
+    // for the host reference engine, which doesn't use Poplar.
+    std::string backend = "hw";
+
+    // The IPU architecture, used for the IPUModel and when compiling for
+    // hardware without attaching to a device.
+    std::string arch = "ipu2";
+
+    // Whether the IPUModel compiles the codelets for the IPU, rather than for
+    // the host. This checks that they build for hardware, but is much slower
+    // to compile for large numbers of tiles.
+    bool compile_ipu_code = false;
+
+    // Whether to only compile the graph program, without attaching to a
+    // device or running it.
+    bool compile_only = false;
+};
+
+// Settings that determine how graph programs are compiled and cached. These
+// are shared by every configuration that is run.
+struct CompileSettings
+{
+    // The codelets used by the graph program, and the flags used to compile
+    // them.
+    std::vector<std::string> codelets;
+    std::string codelet_flags;
+
+    // The host sources that build the graph. These are hashed along with the
+    // codelets for the executable cache, so that changes to how the graph is
+    // built aren't missed if describeGraph isn't updated to match.
+    std::vector<std::string> graph_sources;
+
+    // The directory holding the codelets precompiled by "make codelets".
+    std::string codelet_dir;
+
+    // Options used when compiling the graph program.
+    poplar::OptionFlags engine_options;
+
+    // Where to cache compiled graph programs.
+    std::string cache_dir;
+    bool use_cache = true;
+
+    // Whether to compile even if a cached executable exists, e.g. because
+    // the graph profile is generated during compilation.
+    bool force_compile = false;
+
+    // Whether an IPUModel compiles the codelets for the IPU. (This is a
+    // device option, but changes the executable, so is part of the cache
+    // key.)
+    bool compile_ipu_code = false;
+};
+
+// The values of each scaling parameter to sweep over when benchmarking. Every
+// combination is run.
+struct SweepOptions
+{
+    std::vector<unsigned> num_ipus;
+    std::vector<unsigned> num_tiles_per_ipu;
+    std::vector<unsigned> num_columns;
+    std::vector<unsigned> num_repeats;
+
+    // Whether to replicate the graph for a single IPU across the IPUs, rather
+    // than building a single graph spanning all of them.
+    std::vector<bool> replicate;
+
+    // The number of times to run each configuration. The fastest run is
+    // reported.
+    unsigned num_iterations = 1;
+
+    // The maximum number of configurations to compile concurrently.
+    unsigned num_compile_threads = 4;
+
+    // Where to write the results.
+    std::string path;
+};
+
+// Statistics about the edges between the vertices in a compute set and the
+// tensor regions they are connected to. An edge is cross-tile if any of its
+// elements live on a different tile to the vertex, so must be exchanged.
+struct ExchangeStats
+{
+    std::size_t num_edges = 0;
+    std::size_t num_cross_tile_edges = 0;
+
+    // The number of bytes exchanged each time the compute set runs.
+    std::size_t num_bytes = 0;
+
+    // The number of vertices, and the estimated cycles for each tile, i.e. the
+    // sum of the cycle estimates of the vertices on it.
+    std::size_t num_vertices = 0;
+    std::vector<std::uint64_t> tile_estimates;
+};
+
+// The exchange statistics for each compute set of the algorithms, by name.
+using ExchangeReport = std::vector<std::pair<std::string, ExchangeStats>>;
+
+// The number of codelets that were added to a graph from precompiled objects
+// and from source, and the time taken to add them in milliseconds.
+struct CodeletStats
+{
+    unsigned num_precompiled = 0;
+    unsigned num_compiled = 0;
+    double time = 0;
+};
+
+// Statistics about building and compiling a graph program. (Only available
+// when the executable was compiled, rather than loaded from the cache.)
+struct BuildStats
+{
+    // The time taken to add the codelets and build the graph, and the time
+    // taken to compile it, in milliseconds.
+    double build_time = 0;
+    double compile_time = 0;
+
+    // How the codelets were added.
+    CodeletStats codelets;
+
+    // The exchange statistics for the compute sets of the algorithms.
+    ExchangeReport exchange;
+};
+
+// A graph program that has been compiled (or loaded from the cache), and
+// possibly loaded on the device.
+struct CompiledProgram
+{
+    std::unique_ptr<poplar::Engine> engine;
+
+    // Whether the executable was loaded from the cache.
+    bool is_cached;
+
+    // The time taken to compile (or load) the executable and create the
+    // engine, in milliseconds.
+    double compile_time;
+
+    // The time taken to load the engine on the device, in milliseconds. (Zero
+    // if it hasn't been loaded yet.)
+    double load_time = 0;
+
+    // Statistics about building and compiling the graph program.
+    BuildStats build = {};
+};
+
+// The number of cycles that each tile spent executing an instrumented program.
+struct CycleStats
+{
+    std::uint64_t min;
+    double mean;
+    std::uint64_t max;
+};
+
+// Parse an unsigned integer command-line argument, exiting on failure.
+unsigned parseUnsigned(const std::string &s, const std::string &name);
+
+// Parse a floating point command-line argument, exiting on failure.
+double parseDouble(const std::string &s, const std::string &name);
+
+// Parse a comma separated list of unsigned integers, each of which must lie
+// in the range [min, max], exiting on failure.
+std::vector<unsigned> parseList(
+        const std::string &s,
+        const std::string &name,
+        unsigned min,
+        unsigned max);
+
+// Work out the expected output of the graph program for a single input value,
+// emulating the rounding of each device operation for the data type.
+double referenceOutput(const GraphOptions &options, double input);
+
+// Work out the expected output of the graph program for a single input value
+// of an integer data type exactly, with each device operation wrapping around
+// on overflow. (referenceOutput uses this for integer types, but returns a
+// double, which can't hold every int64.)
+std::int64_t integerReference(const GraphOptions &options, std::int64_t input);
+
+// Connect to a device with the requested number of IPUs.
+poplar::Device setIpuDevice(unsigned num_ipus);
+
+// Create an IPUModel with the requested number of IPUs and tiles per IPU.
+poplar::IPUModel createModel(
+        const DeviceOptions &options,
+        unsigned num_ipus,
+        unsigned num_tiles_per_ipu);
+
+// Connect to a hardware device or create an IPUModel, depending on the
+// backend, with the requested number of IPUs and tiles per IPU. (The number
+// of tiles is only used by the IPUModel.) Exits if no hardware device is
+// available, rather than falling back to the IPUModel. Sets target_name to
+// "ipu" or "ipu_model".
+poplar::Device openDevice(
+        const DeviceOptions &options,
+        unsigned num_ipus,
+        unsigned num_tiles_per_ipu,
+        std::string &target_name);
+
+// Get the target for the backend without attaching to a device, so that graph
+// programs for hardware can be compiled on a machine without IPUs. Sets
+// target_name as for openDevice.
+poplar::Target createTarget(
+        const DeviceOptions &options,
+        unsigned num_ipus,
+        unsigned num_tiles_per_ipu,
+        std::string &target_name);
+
+// Compile (or load from the cache) the graph program for the backend's target
+// without attaching to a device, reporting the time taken. Returns the exit
+// code.
+int compileOnly(
+        GraphOptions options,
+        const DeviceOptions &device_options,
+        unsigned num_tiles_per_ipu,
+        const CompileSettings &settings);
+
+// Load the executable for a graph program from the cache, or build and
+// compile it, storing the result in the cache. Sets is_cached to indicate
+// which of these happened. If build isn't null, it is filled with statistics
+// about building and compiling the graph, if it is compiled. Progress messages
+// are only printed if verbose is set. This is safe to call concurrently for
+// different configurations.
+poplar::Executable getExecutable(
+        const poplar::Target &target,
+        const GraphOptions &options,
+        const CompileSettings &settings,
+        bool &is_cached,
+        BuildStats *build,
+        bool verbose);
+
+// Get the peak resident memory of the host process, in bytes. This is a high
+// water mark for the whole process, so can't be attributed to a single build
+// when several are run concurrently, and is only reported once per process.
+std::size_t peakRss();
+
+// Describe the topology of the graph built by buildGraph. This is used as
+// part of the key for the executable cache, so must be kept in sync with
+// the graph construction below.
+std::string describeGraph(const GraphOptions &options);
+
+// Get the options for a single replica of the graph, i.e. with the number of
+// IPUs and tiles divided by the number of replicas.
+GraphOptions replicaOptions(const GraphOptions &options);
+
+// Get the number of elements of tensor0, i.e. elements_per_worker elements for
+// each worker on every tile.
+std::size_t numElements(const GraphOptions &options);
+
+// Work out the number of elements per worker in a chunk when streaming an
+// input that is larger than the device, so that tensor0 and tensor1, along
+// with the vertex state for the layout, fill chunk_memory_fraction of the
+// memory of each tile.
+unsigned chunkElementsPerWorker(const GraphOptions &options, const poplar::Target &target);
+
+// Get the names of the levels of the tree reduction. The cycles for each can be
+// read back from the host using the handle "reduce_<level>_cycles".
+std::vector<std::string> reductionLevels(const GraphOptions &options);
+
+// Get the name of a vertex layout.
+std::string vertexLayoutName(VertexLayout layout);
+
+// Get the name of a tile mapping strategy.
+std::string mappingName(MappingStrategy mapping);
+
+// Get the name of a constant placement.
+std::string constantPlacementName(ConstantPlacement placement);
+
+// Get the path of the precompiled object for a codelet source file, i.e.
+// <codelet_dir>/<name>.gp.
+std::string codeletObject(const std::string &source, const std::string &codelet_dir);
+
+// Whether the graph program uses the popops library codelets, i.e. whether it
+// has a cross-replica all-reduce.
+bool usesLibraryCodelets(const GraphOptions &options);
+
+// Add the codelets to the graph. The precompiled object for each is loaded if
+// it is at least as new as the source, otherwise the source is compiled. The
+// popops codelets are also added if the graph program uses them. (These are
+// included in the time, but not in the counts.)
+CodeletStats addCodelets(
+        poplar::Graph &graph,
+        const GraphOptions &options,
+        const CompileSettings &settings);
+
+// Report how the codelets were added to the graph. The time taken to compile
+// them all from source is recorded in the cache directory, so that the time
+// saved by loading the precompiled objects can be reported.
+void reportCodelets(const CodeletStats &stats, const CompileSettings &settings);
+
+// Add tensors and compute sets to the graph, returning the programs that will
+// be run. (The codelets must already have been added.) If report isn't null,
+// it is filled with the exchange statistics for the compute sets of the
+// algorithms.
+std::vector<poplar::program::Program> buildGraph(
+        poplar::Graph &graph,
+        const GraphOptions &options,
+        ExchangeReport *report);
+
+// Wrap a program with cycle stamps on each tile, so that the number of cycles
+// each tile spends executing it can be read from the host using the handle.
+poplar::program::Sequence instrument(
+        poplar::Graph &graph,
+        const poplar::program::Program &program,
+        const std::string &handle,
+        unsigned num_tiles);
+
+// Load an engine on the device in the background. The future holds the time
+// taken in milliseconds. Neither the engine nor the device may be used until
+// the future is ready.
+std::future<double> loadAsync(poplar::Engine &engine, poplar::Device &device);
+
+// Load the graph program for a configuration from the cache, or build and
+// compile it, then load it on the device, all in the background. This lets
+// the host prepare its buffers while the program is loading. The device and
+// settings must outlive the future, and the device may not be used until it
+// is ready.
+std::future<CompiledProgram> loadProgramAsync(
+        poplar::Device &device,
+        const GraphOptions &options,
+        const CompileSettings &settings);
+
+// Read the cycle stamps for an instrumented program and work out the min,
+// mean and max number of cycles per tile.
+CycleStats readCycles(
+        poplar::Engine &engine,
+        const std::string &handle,
+        unsigned num_tiles);
+
+// Read the cycle stamps for an instrumented program and report the min, max
+// and mean number of cycles per tile, which are returned.
+CycleStats reportCycles(
+        poplar::Engine &engine,
+        const std::string &handle,
+        unsigned num_tiles,
+        double clock_frequency);
+
+// Run each step of the graph program separately, reporting the cycles per tile
+// for each. If report isn't null, the timings are also added to it.
+void runSteps(
+        poplar::Engine &engine,
+        unsigned num_tiles,
+        double clock_frequency,
+        PerformanceReport *report);
+
+// Run the fused graph program, reporting the cycles per tile for each phase.
+// If report isn't null, the timings are also added to it.
+void runFused(
+        poplar::Engine &engine,
+        unsigned num_tiles,
+        double clock_frequency,
+        PerformanceReport *report);
+
+// Run the global tree reduction, reporting the cycles per tile for each level.
+// If report isn't null, the timings are also added to it. Returns the global
+// sum.
+double runReduce(
+        poplar::Engine &engine,
+        const GraphOptions &options,
+        const poplar::Target &target,
+        PerformanceReport *report);
+
+// Add the configuration, the compile and load times, the statistics for the
+// compute sets of the algorithms, and the memory used by each tile, read from
+// the graph profile, to the performance report.
+void recordProgram(
+        PerformanceReport &report,
+        const GraphOptions &options,
+        const std::string &target_name,
+        const CompiledProgram &program,
+        double prepare_time,
+        const std::string &profile_path);
+
+// Add the host time (if known) and cycles per tile for an instrumented program
+// to the "phases" section of the performance report, if it isn't null.
+void recordPhase(
+        PerformanceReport *report,
+        const std::string &name,
+        double host_time,
+        const CycleStats &cycles);
+
+// Compare the estimated cycles for the busiest tile of each compute set of the
+// algorithms with the maximum cycles per tile measured for a single execution
+// of it in the last run, as a check on the cycle estimators. The handles of
+// the measured cycles are prefixed with prefix, e.g. for the fused program.
+// If report isn't null, the comparison is also added to it.
+void reportEstimates(
+        poplar::Engine &engine,
+        const GraphOptions &options,
+        const ExchangeReport &exchange,
+        const std::string &prefix,
+        PerformanceReport *report);
+
+// Run the graph program on the host using the CPU reference engine, reporting
+// the time for each step and the throughput. Returns the exit code.
+int runCpu(const GraphOptions &options, unsigned num_threads);
+
+// Connect the input and output streams to host buffers holding one element
+// for each worker on every tile. Each replica streams its own contiguous
+// slice of the buffers.
+void connectStreams(
+        poplar::Engine &engine,
+        const GraphOptions &options,
+        char *buffer_in,
+        char *buffer_out);
+
+// Write the values that are added and multiplied by the algorithms to the
+// device. (Only valid when the values are written at runtime.)
+void writeValues(
+        poplar::Engine &engine,
+        const GraphOptions &options,
+        const poplar::Target &target);
+
+// Write the number of repeats of the addition to the device. (Only valid when
+// the number of repeats is written at runtime.)
+void writeRepeats(poplar::Engine &engine, const GraphOptions &options);
+
+// Measure the per-iteration overhead of the runtime add loop compared to a
+// static Repeat, using the cycles from the last run of the add program with
+// the given handle.
+void reportLoopOverhead(
+        poplar::Engine &engine,
+        const GraphOptions &options,
+        const std::string &add_handle,
+        double clock_frequency);
+
+// Run the steps of the graph program for a number of different sets of
+// values back to back, writing each set to the device rather than recompiling,
+// and report the time taken compared to compiling (or loading) an executable
+// for each. Returns the number of sets that failed validation.
+unsigned runValueSets(
+        poplar::Engine &engine,
+        const GraphOptions &options,
+        const poplar::Target &target,
+        unsigned num_sets,
+        double compile_time);
+
+// Stream batches through the fused on-device loop, reporting throughput.
+// Returns the number of batches that failed validation.
+unsigned runBatches(
+        poplar::Engine &engine,
+        const GraphOptions &options,
+        const poplar::Target &target);
+
+// Stream an input on the host, that is up to num_batches chunks long, through
+// the fused on-device loop one chunk at a time. The input is read from
+// input_file, if it isn't null, otherwise each chunk is generated as it is
+// streamed. Likewise, the output is written to output_file, if it isn't null,
+// otherwise each chunk is validated as it arrives and then dropped. Reports
+// the end-to-end throughput, and returns the number of chunks that failed
+// validation.
+unsigned runOutOfCore(
+        poplar::Engine &engine,
+        const GraphOptions &options,
+        const poplar::Target &target,
+        const MappedFile *input_file,
+        MappedFile *output_file);
+
+// Run every combination of the scaling parameters in the sweep, writing the
+// compile, load, copy and compute times for each, along with the derived
+// bandwidth and throughput, to a CSV or JSON file. The remaining graph
+// options are taken from base_options. Returns the exit code.
+int runBenchmark(
+        const GraphOptions &base_options,
+        const SweepOptions &sweep,
+        const DeviceOptions &device_options,
+        const CompileSettings &settings);
+
+// Compute the time in milliseconds relative to a starting point.
+double timeIt(const std::chrono::time_point<std::chrono::steady_clock> &start);
+
+int main(int argc, char *argv[])
+{
+    // Specify the number of IPUs and tiles per IPU to use, the number of
+    // columns in tensor1 and the number of times to repeat the addition.
+    // These can be overriden from the command-line. When benchmarking, each
+    // can be given as a comma separated list of values to sweep over.
+    SweepOptions sweep;
+    sweep.num_ipus = {1};
+    sweep.num_tiles_per_ipu = {2};
+    sweep.num_columns = {20};
+    sweep.num_repeats = {100};
+    sweep.replicate = {false};
+
+    // Where to cache compiled graph programs. Caching can be disabled from
+    // the command-line.
+    CompileSettings settings;
+    settings.cache_dir = ".ipu_cache";
+
+    // Options for the graph program. By default, each step of the graph
+    // program is run separately using one vertex per element.
+    GraphOptions graph_options;
+
+    // Whether to print a summary of the compiled graph, e.g. the memory used
+    // per tile and the number of vertices.
+    bool print_summary = false;
+
+    // Where to write a JSON performance report, if requested, and the
+    // directory that the Poplar profiles are written to.
+    std::string report_path;
+    const std::string profile_dir = "profile";
+
+    // The number of different sets of values to run using the same
+    // executable, when the values are written at runtime.
+    unsigned num_value_sets = 0;
+
+    // The size of the input to stream through the device in chunks, as a
+    // multiple of the largest chunk that fits in tile memory. If zero, the
+    // input is a single block of one element per worker.
+    unsigned out_of_core = 0;
+
+    // Binary files (raw or .npy) to stream the input from and write the
+    // output to, rather than generating the input on the host.
+    std::string input_path;
+    std::string output_path;
+
+    // The device used to run the graph program, whether any IPUModel options
+    // were given, and the number of host threads used by the CPU backend.
+    DeviceOptions device_options;
+    bool model_options = false;
+    unsigned num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+    // Rudimentary command-line argument parsing. Options start with "--",
+    // anything else is a positional argument.
+    std::vector<std::string> positional;
+    for (int i=1; i<argc; ++i)
+    {
+        std::string arg(argv[i]);
+
+        if (arg.rfind("--", 0) != 0)
+        {
+            positional.push_back(arg);
+            continue;
+        }
+
+        // Split the option into its name and value, e.g. --name=value.
+        const auto pos = arg.find('=');
+        const auto name = arg.substr(0, pos);
+        const auto value = (pos == std::string::npos) ? "" : arg.substr(pos+1);
+
+        if (name == "--cache-dir")
+        {
+            if (value.empty())
+            {
+                std::cerr << "Missing directory for --cache-dir!\n";
+                exit(-1);
+            }
+            settings.cache_dir = value;
+        }
+        else if (name == "--no-cache")
+        {
+            settings.use_cache = false;
+        }
+        else if (name == "--backend")
+        {
+            if ((value != "hw") and (value != "model") and (value != "cpu"))
+            {
+                std::cerr << "Backend must be one of 'hw', 'model' or 'cpu'!\n";
+                exit(-1);
+            }
+            device_options.backend = value;
+        }
+        else if (name == "--model-arch")
+        {
+            if ((value != "ipu1") and (value != "ipu2"))
+            {
+                std::cerr << "IPUModel architecture must be one of 'ipu1' or 'ipu2'!\n";
+                exit(-1);
+            }
+            device_options.arch = value;
+            model_options = true;
+        }
+        else if (name == "--model-ipu-code")
+        {
+            device_options.compile_ipu_code = true;
+            model_options = true;
+        }
+        else if (name == "--compile-only")
+        {
+            device_options.compile_only = true;
+        }
+        else if (name == "--threads")
+        {
+            num_threads = parseUnsigned(value, "number of threads");
+            if (num_threads < 1)
+            {
+                std::cerr << "Number of threads must be at least 1!\n";
+                exit(-1);
+            }
+        }
+        else if (name == "--summary")
+        {
+            print_summary = true;
+        }
+        else if (name == "--report")
+        {
+            if (value.empty())
+            {
+                std::cerr << "Missing output file for --report!\n";
+                exit(-1);
+            }
+            report_path = value;
+        }
+        else if (name == "--replicate")
+        {
+            if (value.empty())
+            {
+                sweep.replicate = {true};
+            }
+            else if (value == "both")
+            {
+                sweep.replicate = {false, true};
+            }
+            else
+            {
+                std::cerr << "--replicate only accepts the value 'both'!\n";
+                exit(-1);
+            }
+        }
+        else if (name == "--fused")
+        {
+            graph_options.fused = true;
+        }
+        else if (name == "--multiply-sum")
+        {
+            graph_options.multiply_sum = true;
+        }
+        else if (name == "--reduce")
+        {
+            graph_options.reduce = true;
+        }
+        else if (name == "--dtype")
+        {
+            if (not parseDataType(value, graph_options.dtype))
+            {
+                std::cerr << "Data type must be one of 'int', 'float', 'half' or 'int64'!\n";
+                exit(-1);
+            }
+        }
+        else if (name == "--add-value")
+        {
+            graph_options.add_value = parseDouble(value, "add value");
+        }
+        else if (name == "--multiply-value")
+        {
+            graph_options.multiply_value = parseDouble(value, "multiply value");
+        }
+        else if (name == "--runtime-values")
+        {
+            graph_options.runtime_values = true;
+        }
+        else if (name == "--runtime-repeats")
+        {
+            graph_options.runtime_repeats = true;
+        }
+        else if (name == "--value-sets")
+        {
+            num_value_sets = parseUnsigned(value, "number of value sets");
+        }
+        else if (name == "--batches")
+        {
+            graph_options.num_batches = parseUnsigned(value, "number of batches");
+        }
+        else if ((name == "--input") or (name == "--output"))
+        {
+            if (value.empty())
+            {
+                std::cerr << "Missing file for " << name << "!\n";
+                exit(-1);
+            }
+            (name == "--input" ? input_path : output_path) = value;
+        }
+        else if (name == "--out-of-core")
+        {
+            out_of_core = parseUnsigned(value, "number of chunks");
+            if (out_of_core < 1)
+            {
+                std::cerr << "Number of chunks must be at least 1!\n";
+                exit(-1);
+            }
+        }
+        else if (name == "--width")
+        {
+            sweep.num_columns = parseList(
+                value, "width", 1, std::numeric_limits<unsigned>::max());
+        }
+        else if (name == "--repeats")
+        {
+            sweep.num_repeats = parseList(
+                value, "number of repeats", 1, std::numeric_limits<unsigned>::max());
+        }
+        else if (name == "--benchmark")
+        {
+            if (value.empty())
+            {
+                std::cerr << "Missing output file for --benchmark!\n";
+                exit(-1);
+            }
+            sweep.path = value;
+        }
+        else if (name == "--compile-jobs")
+        {
+            sweep.num_compile_threads = parseUnsigned(value, "number of compile jobs");
+            if (sweep.num_compile_threads < 1)
+            {
+                std::cerr << "Number of compile jobs must be at least 1!\n";
+                exit(-1);
+            }
+        }
+        else if (name == "--iterations")
+        {
+            sweep.num_iterations = parseUnsigned(value, "number of iterations");
+            if (sweep.num_iterations < 1)
+            {
+                std::cerr << "Number of iterations must be at least 1!\n";
+                exit(-1);
+            }
+        }
+        else if (name == "--mapping")
+        {
+            if (value == "linear")
+            {
+                graph_options.mapping = MappingStrategy::LINEAR;
+            }
+            else if (value == "worker")
+            {
+                graph_options.mapping = MappingStrategy::WORKER;
+            }
+            else if (value == "grain")
+            {
+                graph_options.mapping = MappingStrategy::GRAIN;
+            }
+            else
+            {
+                std::cerr << "Tile mapping must be one of 'linear', 'worker' or 'grain'!\n";
+                exit(-1);
+            }
+        }
+        else if (name == "--constants")
+        {
+            if (value == "tile0")
+            {
+                graph_options.constants = ConstantPlacement::TILE0;
+            }
+            else if (value == "per-tile")
+            {
+                graph_options.constants = ConstantPlacement::PER_TILE;
+            }
+            else
+            {
+                std::cerr << "Constant placement must be one of 'tile0' or 'per-tile'!\n";
+                exit(-1);
+            }
+        }
+        else if (name == "--vertices")
+        {
+            if (value == "scalar")
+            {
+                graph_options.vertices = VertexLayout::SCALAR;
+            }
+            else if (value == "vector")
+            {
+                graph_options.vertices = VertexLayout::VECTOR;
+            }
+            else if (value == "multi")
+            {
+                graph_options.vertices = VertexLayout::MULTI;
+            }
+            else
+            {
+                std::cerr << "Vertex layout must be one of 'scalar', 'vector' or 'multi'!\n";
+                exit(-1);
+            }
+        }
+        else
+        {
+            std::cerr << "Unknown option: " << arg << '\n';
+            exit(-1);
+        }
+    }
+
+    // Vertices that write a single half would share 32-bit words with the
+    // vertices for neighbouring elements on other workers, so halves are only
+    // supported when the workers are partitioned inside a multi-vertex.
+    if ((graph_options.dtype == DataType::HALF) and
+        (graph_options.vertices != VertexLayout::MULTI))
+    {
+        std::cerr << "The 'half' data type requires --vertices=multi!\n";
+        exit(-1);
+    }
+
+    // Running several sets of values with one executable requires the values
+    // to be written at runtime.
+    if ((num_value_sets > 0) and not graph_options.runtime_values)
+    {
+        std::cerr << "--value-sets requires --runtime-values!\n";
+        exit(-1);
+    }
+
+    // Get the number of IPUs. (Check against hardcoded limits. Can query
+    // device to see what's available.)
+    if (positional.size() > 0)
+    {
+        sweep.num_ipus = parseList(positional[0], "number of IPUs", 1, 4);
+    }
+    // Get the number of tiles per IPU.
+    if (positional.size() > 1)
+    {
+        sweep.num_tiles_per_ipu = parseList(positional[1], "number of tiles per IPU", 1, 1472);
+    }
+
+    // Run every combination of the scaling parameters, then we're done.
+    // (The benchmark only times the individual steps, so the optional
+    // programs aren't built.)
+    const bool benchmark = not sweep.path.empty();
+    if (benchmark)
+    {
+        if (device_options.backend == "cpu")
+        {
+            std::cerr << "--benchmark requires the 'hw' or 'model' backend!\n";
+            exit(-1);
+        }
+        if ((graph_options.num_batches > 0) or graph_options.fused or
+            graph_options.reduce or print_summary or not report_path.empty())
+        {
+            std::cerr << "--benchmark can't be combined with --batches, --fused, "
+                      << "--reduce, --summary or --report!\n";
+            exit(-1);
+        }
+    }
+    else if ((sweep.num_ipus.size() > 1) or (sweep.num_tiles_per_ipu.size() > 1) or
+             (sweep.num_columns.size() > 1) or (sweep.num_repeats.size() > 1) or
+             (sweep.replicate.size() > 1))
+    {
+        std::cerr << "Lists of values (and --replicate=both) are only supported "
+                  << "with --benchmark!\n";
+        exit(-1);
+    }
+
+    // Streaming batches only runs the fused on-device loop, so can't be
+    // combined with the other programs, or with the summary and report of a
+    // normal run. Replicas would also stream their own slice of the input and
+    // output, which isn't supported by the host callbacks used for batches.
+    if ((graph_options.num_batches > 0) and
+        (graph_options.fused or graph_options.reduce or sweep.replicate.back() or
+         (num_value_sets > 0) or print_summary or not report_path.empty()))
+    {
+        std::cerr << "--batches can't be combined with --fused, --reduce, --replicate, "
+                  << "--value-sets, --summary or --report!\n";
+        exit(-1);
+    }
+
+    if (sweep.replicate.back() and (device_options.backend == "cpu"))
+    {
+        std::cerr << "--replicate requires the 'hw' or 'model' backend!\n";
+        exit(-1);
+    }
+
+    // The number of chunks is set by the size of an input file, and an
+    // output file is only written when streaming chunks.
+    const bool stream_chunks = (out_of_core > 0) or not input_path.empty();
+    if ((out_of_core > 0) and not input_path.empty())
+    {
+        std::cerr << "--out-of-core can't be combined with --input!\n";
+        exit(-1);
+    }
+    if (not output_path.empty() and not stream_chunks)
+    {
+        std::cerr << "--output requires --input or --out-of-core!\n";
+        exit(-1);
+    }
+
+    // Streaming an input larger than the device uses the fused on-device loop
+    // for batches, with chunks sized from the memory of the target, so needs
+    // a device and can't be combined with the other modes of running.
+    if (stream_chunks)
+    {
+        if ((device_options.backend == "cpu") or benchmark or device_options.compile_only)
+        {
+            std::cerr << "--out-of-core and --input require the 'hw' or 'model' backend, "
+                      << "and can't be combined with --benchmark or --compile-only!\n";
+            exit(-1);
+        }
+        if ((graph_options.num_batches > 0) or graph_options.fused or graph_options.reduce or
+            sweep.replicate.back() or (num_value_sets > 0))
+        {
+            std::cerr << "--out-of-core and --input can't be combined with --batches, "
+                      << "--fused, --reduce, --replicate or --value-sets!\n";
+            exit(-1);
+        }
+    }
+
+    // The IPUModel options don't apply to the other backends.
+    if (model_options and (device_options.backend != "model"))
+    {
+        std::cerr << "--model-arch and --model-ipu-code require the 'model' backend!\n";
+        exit(-1);
+    }
+
+    // Compiling without running can't be combined with anything that needs
+    // the device.
+    if (device_options.compile_only and
+        ((device_options.backend == "cpu") or benchmark or print_summary or
+         not report_path.empty() or (num_value_sets > 0)))
+    {
+        std::cerr << "--compile-only can't be combined with the 'cpu' backend, "
+                  << "--benchmark, --summary, --report or --value-sets!\n";
+        exit(-1);
+    }
+
+    const unsigned num_ipus = sweep.num_ipus[0];
+    const unsigned num_tiles_per_ipu = sweep.num_tiles_per_ipu[0];
+    graph_options.num_columns = sweep.num_columns[0];
+    graph_options.num_repeats = sweep.num_repeats[0];
+
+    // Run on the host, without using Poplar. The CPU engine uses the same
+    // number of workers per tile as the IPU.
+    if (device_options.backend == "cpu")
+    {
+        graph_options.num_ipus = num_ipus;
+        graph_options.num_tiles = num_ipus * num_tiles_per_ipu;
+        graph_options.num_workers = 6;
+
+        return runCpu(graph_options, num_threads);
+    }
+
+    // The codelets used by the graph program, and the flags used to compile
+    // them.
+    settings.codelets = {
+        "src/AddSomethingCodelet.cpp",
+        "src/MultiplySomethingNumTimesCodelet.cpp",
+        "src/SumCodelet.cpp",
+        "src/MultiplySumCodelet.cpp",
+        "src/CountDownCodelet.cpp"
+    };
+    settings.codelet_flags = "-O3";
+    settings.codelet_dir = "codelets";
+    settings.compile_ipu_code = device_options.compile_ipu_code;
+    settings.graph_sources = {
+        "src/main.cpp",
+        "src/CycleEstimators.hpp",
+        "src/DataType.hpp"
+    };
+
+    // Generate a graph profile when a summary or report is requested. (This
+    // is only produced during compilation, so we always need to compile.)
+    if (print_summary or not report_path.empty())
+    {
+        settings.engine_options.set("autoReport.outputGraphProfile", "true");
+        settings.engine_options.set("autoReport.directory", profile_dir);
+        settings.force_compile = true;
+    }
+
+    if (benchmark)
+    {
+        return runBenchmark(graph_options, sweep, device_options, settings);
+    }
+
+    // Map the input file, checking that it holds elements of the data type.
+    std::optional<MappedFile> input_file;
+    if (not input_path.empty())
+    {
+        try
+        {
+            input_file.emplace(MappedFile::openRead(input_path));
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << e.what() << '\n';
+            exit(-1);
+        }
+
+        const auto descr = npyDescr(graph_options.dtype);
+        if (input_file->isNpy() and (input_file->descr() != descr))
+        {
+            std::cerr << "Input file has NumPy type '" << input_file->descr()
+                      << "', but --dtype=" << dataTypeName(graph_options.dtype)
+                      << " requires '" << descr << "'!\n";
+            exit(-1);
+        }
+        if (input_file->size() % typeSize(graph_options.dtype) != 0)
+        {
+            std::cerr << "Input file isn't a whole number of "
+                      << dataTypeName(graph_options.dtype) << " elements!\n";
+            exit(-1);
+        }
+        if (input_file->size() == 0)
+        {
+            std::cerr << "Input file has no elements to stream!\n";
+            exit(-1);
+        }
+    }
+
+    // Store the total number of tiles.
+    const unsigned num_tiles = num_ipus * num_tiles_per_ipu;
+
+    graph_options.num_ipus = num_ipus;
+    graph_options.num_tiles = num_tiles;
+
+    // Replicate the graph for a single IPU across all of the IPUs.
+    if (sweep.replicate[0])
+    {
+        graph_options.num_replicas = num_ipus;
+        std::cout << "Replicating the graph for a single IPU " << num_ipus << " times.\n";
+    }
+
+    // Compile the graph program without running it, then we're done.
+    if (device_options.compile_only)
+    {
+        return compileOnly(graph_options, device_options, num_tiles_per_ipu, settings);
+    }
+
+    // Connect to a device with the requested number of IPUs.
+    std::string target_name;
+    auto device = openDevice(device_options, num_ipus, num_tiles_per_ipu, target_name);
+
+    std::string ipu_string = (num_ipus > 1) ? "IPUs" : "IPU";
+    std::cout << "Using " << (target_name == "ipu" ? "a device" : "an IPUModel")
+              << " with " << num_ipus << " " << ipu_string
+              << " and " << num_tiles_per_ipu << " tiles per IPU.\n";
+    if (target_name == "ipu_model")
+    {
+        std::cout << "Cycle counts are estimates. Ignore host timing statistics.\n";
+    }
+
+    // Store the number of hardware workers per tile. We'll make use of all
+    // threads.
+    const unsigned num_workers = device.getTarget().getNumWorkerContexts();
+    graph_options.num_workers = num_workers;
+
+    // When streaming an input that is larger than the device, size the chunks
+    // to fill the tile memory, and stream one chunk per batch. An input file
+    // is covered by as many chunks as needed, and if it fits on the device,
+    // the chunk is shrunk to fit it.
+    std::optional<MappedFile> output_file;
+    if (stream_chunks)
+    {
+        graph_options.elements_per_worker = chunkElementsPerWorker(graph_options, device.getTarget());
+        graph_options.num_batches = out_of_core;
+
+        if (input_file)
+        {
+            const std::size_t num_samples = input_file->size() / typeSize(graph_options.dtype);
+            const std::size_t num_workers_all = std::size_t(num_tiles) * num_workers;
+            graph_options.elements_per_worker = std::min<std::size_t>(
+                graph_options.elements_per_worker,
+                (num_samples + num_workers_all - 1) / num_workers_all);
+
+            const auto chunk_size = numElements(graph_options);
+            graph_options.num_batches = (num_samples + chunk_size - 1) / chunk_size;
+        }
+
+        // Create the output file, with the same size and shape as the input.
+        if (not output_path.empty())
+        {
+            const auto type_size = typeSize(graph_options.dtype);
+            const std::size_t num_bytes = input_file ? input_file->size() :
+                graph_options.num_batches * numElements(graph_options) * type_size;
+            const auto shape = (input_file and input_file->isNpy()) ?
+                input_file->shape() : std::vector<std::size_t>{num_bytes / type_size};
+
+            try
+            {
+                output_file.emplace(MappedFile::create(output_path, num_bytes,
+                    npyDescr(graph_options.dtype), shape,
+                    input_file and input_file->fortranOrder()));
+            }
+            catch (const std::exception &e)
+            {
+                std::cerr << e.what() << '\n';
+                exit(-1);
+            }
+        }
+    }
+
+    // Work out the size of our tensors. (For simplicity, we'll have one element
+    // for each worker on each tile, unless streaming chunks.)
+    const std::size_t num_workers_total = numElements(graph_options);
+
+    // Report the memory saved by not storing tensor1. This is an estimate,
+    // since the saving on each tile depends on how tensor1 would have been
+    // mapped, so assume its rows are spread as evenly as possible, and report
+    // the saving on the tile that would have held the most.
+    if (graph_options.multiply_sum)
+    {
+        const std::size_t rows_per_tile = (num_workers_total + num_tiles - 1) / num_tiles;
+        std::cout << "Fusing multiply and sum, saving about "
+                  << rows_per_tile * graph_options.num_columns * typeSize(graph_options.dtype)
+                  << " bytes per tile (estimated).\n";
+    }
+
+    // Load the graph program from the cache, or build and compile it, then
+    // load it on the device. This happens in the background, so that the
+    // host buffers can be prepared in the meantime.
+    auto loading = loadProgramAsync(device, graph_options, settings);
+
+    // Create a buffers to hold our input/output, zeroing the input buffer.
+    auto start = std::chrono::steady_clock::now();
+    const auto dtype = graph_options.dtype;
+    const auto &target = device.getTarget();
+    std::vector<char> buffer_in(num_workers_total * typeSize(dtype));
+    std::vector<char> buffer_out(num_workers_total * typeSize(dtype));
+    fillBuffer(dtype, target, buffer_in.data(), num_workers_total, 0);
+    const auto prepare_time = timeIt(start);
+
+    // Wait for the program to be loaded.
+    auto program = loading.get();
+    auto &engine = *program.engine;
+    std::cout << "  Took " << program.compile_time << " ms\n";
+    std::cout << "Loading program on device...\n";
+    std::cout << "  Took " << program.load_time << " ms\n";
+    std::cout << "Prepared host buffers in " << prepare_time
+              << " ms while compiling and loading.\n";
+    std::cout << "Peak host RSS " << peakRss() / (1024 * 1024) << " MB\n";
+
+    // Collect the timings of the run into a report, if requested. This is
+    // written when we're done.
+    PerformanceReport report;
+    PerformanceReport *report_ptr = report_path.empty() ? nullptr : &report;
+    if (report_ptr != nullptr)
+    {
+        recordProgram(report, graph_options, target_name, program,
+            prepare_time, profile_dir + "/profile.pop");
+    }
+    auto write_report = [&]
+    {
+        if (report_ptr != nullptr)
+        {
+            report.setNumber("memory", "peak_host_rss_bytes", peakRss());
+            report.write(report_path);
+            std::cout << "Wrote performance report to " << report_path << '\n';
+        }
+    };
+
+    // Write the values used by the algorithms, and the number of repeats.
+    if (graph_options.runtime_values)
+    {
+        writeValues(engine, graph_options, target);
+    }
+    if (graph_options.runtime_repeats)
+    {
+        writeRepeats(engine, graph_options);
+    }
+
+    // Stream the batches (or chunks) through the device, then we're done.
+    if (graph_options.num_batches > 0)
+    {
+        const auto num_failed = stream_chunks ?
+            runOutOfCore(engine, graph_options, target,
+                input_file ? &*input_file : nullptr,
+                output_file ? &*output_file : nullptr) :
+            runBatches(engine, graph_options, target);
+        if (num_failed > 0)
+        {
+            exit(-1);
+        }
+        write_report();
+
+        std::cout << "Done!\n";
+
+        return 0;
+    }
+
+    // Connect input/output data stream.
+    connectStreams(engine, graph_options, buffer_in.data(), buffer_out.data());
+
+    // Run the graph program.
+    const auto clock_frequency = target.getTileClockFrequency();
+    if (graph_options.fused)
+    {
+        runFused(engine, num_tiles, clock_frequency, report_ptr);
+    }
+    else
+    {
+        runSteps(engine, num_tiles, clock_frequency, report_ptr);
+    }
+
+    // Check the cycle estimators against the measured cycles. (The estimates
+    // are only known when the program was compiled.)
+    if (not program.is_cached)
+    {
+        reportEstimates(engine, graph_options, program.build.exchange,
+            graph_options.fused ? "fused_" : "", report_ptr);
+    }
+
+    // Loop over the output buffer to validate the output.
+    std::cout << "Validating output...\n";
+    const auto output = readBuffer(dtype, target, buffer_out.data(), num_workers_total);
+    const auto expected = referenceOutput(graph_options, 0);
+    for (unsigned i=0; i<output.size(); ++i)
+    {
+        // By default, each value should be 5*100*10*20 = 100000, unless this
+        // overflows the data type.
+        assert(output[i] == expected);
+    }
+
+    // Reduce the output across all workers, tiles and IPUs.
+    if (graph_options.reduce)
+    {
+        const auto sum = runReduce(engine, graph_options, target, report_ptr);
+
+        // Integer sums wrap around modulo 2^32 (or 2^64), so are worked out
+        // in integer arithmetic. Floating point sums depend on the order of
+        // the reduction, so allow a small tolerance.
+        std::cout << "Validating global sum...\n";
+        if ((dtype == DataType::INT) or (dtype == DataType::INT64))
+        {
+            const auto expected_sum = wrapToType(dtype, std::uint64_t(num_workers_total) *
+                std::uint64_t(integerReference(graph_options, 0)));
+            assert(sum == static_cast<double>(expected_sum));
+        }
+        else
+        {
+            const auto expected_sum = roundToType(dtype, num_workers_total * expected);
+            if (std::isinf(expected_sum))
+            {
+                assert(sum == expected_sum);
+            }
+            else
+            {
+                assert(std::fabs(sum - expected_sum) <= 1e-3 * std::fabs(expected_sum));
+            }
+        }
+    }
+
+    // Compare the cost of the runtime add loop with a static Repeat. (This
+    // modifies tensor0, so must come after the output has been used.)
+    if (graph_options.runtime_repeats)
+    {
+        reportLoopOverhead(
+            engine,
+            graph_options,
+            graph_options.fused ? "fused_add_cycles" : "add_cycles",
+            clock_frequency);
+    }
+
+    // Run the remaining sets of values using the same executable.
+    if (num_value_sets > 0)
+    {
+        if (runValueSets(engine, graph_options, target, num_value_sets, program.compile_time) > 0)
+        {
+            exit(-1);
+        }
+    }
+
+    // Print a summary of the compiled graph.
+    if (print_summary)
+    {
+        std::cout << "\nGraph summary:\n";
+        engine.printProfileSummary(std::cout);
+    }
+
+    write_report();
+
+    std::cout << "Done!\n";
+
+    return 0;
+}
+
+unsigned parseUnsigned(const std::string &s, const std::string &name)
+{
+    // Capitalise the name for messages that start with it.
+    auto Name = name;
+    Name[0] = std::toupper(Name[0]);
+
+    try
+    {
+        std::size_t pos;
+        const auto value = std::stoul(s, &pos);
+        if (pos < s.size())
+        {
+            std::cerr << "Trailing characters after " << name << ": " << s << '\n';
+            exit(-1);
+        }
+        if ((value > std::numeric_limits<unsigned>::max()) or (s[0] == '-'))
+        {
+            throw std::out_of_range(s);
+        }
+        return value;
+    }
+    catch (std::invalid_argument const &ex)
+    {
+        std::cerr << "Invalid " << name << ": " << s << '\n';
+        exit(-1);
+    }
+    catch (std::out_of_range const &ex)
+    {
+        std::cerr << Name << " out of range: " << s << '\n';
+        exit(-1);
+    }
+}
+
+double parseDouble(const std::string &s, const std::string &name)
+{
+    // Capitalise the name for messages that start with it.
+    auto Name = name;
+    Name[0] = std::toupper(Name[0]);
+
+    try
+    {
+        std::size_t pos;
+        const auto value = std::stod(s, &pos);
+        if (pos < s.size())
+        {
+            std::cerr << "Trailing characters after " << name << ": " << s << '\n';
+            exit(-1);
+        }
+        return value;
+    }
+    catch (std::invalid_argument const &ex)
+    {
+        std::cerr << "Invalid " << name << ": " << s << '\n';
+        exit(-1);
+    }
+    catch (std::out_of_range const &ex)
+    {
+        std::cerr << Name << " out of range: " << s << '\n';
+        exit(-1);
+    }
+}
+
+std::vector<unsigned> parseList(
+        const std::string &s,
+        const std::string &name,
+        unsigned min,
+        unsigned max)
+{
+    // Capitalise the name for messages that start with it.
+    auto Name = name;
+    Name[0] = std::toupper(Name[0]);
+
+    std::vector<unsigned> values;
+    std::istringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+        const auto value = parseUnsigned(item, name);
+        if ((value < min) or (value > max))
+        {
+            std::cerr << Name << " must be between " << min << " and " << max << "!\n";
+            exit(-1);
+        }
+        values.push_back(value);
+    }
+
+    if (values.empty())
+    {
+        std::cerr << "Missing " << name << "!\n";
+        exit(-1);
+    }
+
+    return values;
+}
+
+double referenceOutput(const GraphOptions &options, double input)
+{
+    const auto dtype = options.dtype;
+
+    if ((dtype == DataType::INT) or (dtype == DataType::INT64))
+    {
+        return static_cast<double>(integerReference(options, static_cast<std::int64_t>(input)));
+    }
+
+    // Repeat add.
+    auto x = roundToType(dtype, input);
+    for (unsigned i=0; i<options.num_repeats; ++i)
+    {
+        x = roundToType(dtype, x + roundToType(dtype, options.add_value));
+    }
+
+    // Multiply.
+    x = roundToType(dtype, x * roundToType(dtype, options.multiply_value));
+
+    // Sum.
+    double sum = 0;
+    for (unsigned i=0; i<options.num_columns; ++i)
+    {
+        sum = roundToType(dtype, sum + x);
+    }
+
+    return sum;
+}
+
+std::int64_t integerReference(const GraphOptions &options, std::int64_t input)
+{
+    const auto dtype = options.dtype;
+    auto wrap = [dtype](std::uint64_t x)
+    {
+        return static_cast<std::uint64_t>(wrapToType(dtype, x));
+    };
+
+    const auto add_value = wrap(static_cast<std::int64_t>(options.add_value));
+    const auto multiply_value = wrap(static_cast<std::int64_t>(options.multiply_value));
+
+    // Repeat add.
+    auto x = wrap(input);
+    for (unsigned i=0; i<options.num_repeats; ++i)
+    {
+        x = wrap(x + add_value);
+    }
+
+    // Multiply.
+    x = wrap(x * multiply_value);
+
+    // Sum.
+    std::uint64_t sum = 0;
+    for (unsigned i=0; i<options.num_columns; ++i)
+    {
+        sum = wrap(sum + x);
+    }
+
+    return static_cast<std::int64_t>(sum);
+}
+
+poplar::Device setIpuDevice(unsigned num_ipus)
+{
+    auto dm = poplar::DeviceManager::createDeviceManager();
+    auto hwDevices = dm.getDevices(poplar::TargetType::IPU, num_ipus);
+    if (hwDevices.size() > 0)
+    {
+        for (auto &d : hwDevices)
+        {
+            if (d.attach())
+            {
+                return std::move(d);
+            }
+        }
+    }
+
+    throw std::runtime_error("Unable to connect to IPU device!");
+}
+
+poplar::IPUModel createModel(
+        const DeviceOptions &options,
+        unsigned num_ipus,
+        unsigned num_tiles_per_ipu)
+{
+    // Only model the tiles that are used, since the time taken to compile
+    // and simulate the graph program grows with the number of tiles in the
+    // target. Unless requested, the codelets are compiled for the host,
+    // which is much faster.
+    poplar::IPUModel model(options.arch.c_str());
+    model.numIPUs = num_ipus;
+    model.tilesPerIPU = num_tiles_per_ipu;
+    model.compileIPUCode = options.compile_ipu_code;
+
+    return model;
+}
+
+poplar::Device openDevice(
+        const DeviceOptions &options,
+        unsigned num_ipus,
+        unsigned num_tiles_per_ipu,
+        std::string &target_name)
+{
+    if (options.backend == "model")
+    {
+        target_name = "ipu_model";
+        return createModel(options, num_ipus, num_tiles_per_ipu).createDevice();
+    }
+
+    try
+    {
+        auto device = setIpuDevice(num_ipus);
+        target_name = "ipu";
+        return device;
+    }
+    catch (const std::exception &)
+    {
+        std::string ipu_string = (num_ipus > 1) ? "IPUs" : "IPU";
+        std::cerr << "Unable to connect to a device with "
+                  << num_ipus << " " << ipu_string << ". "
+                  << "Use --backend=model to run on an IPUModel instead.\n";
+        exit(-1);
+    }
+}
+
+poplar::Target createTarget(
+        const DeviceOptions &options,
+        unsigned num_ipus,
+        unsigned num_tiles_per_ipu,
+        std::string &target_name)
+{
+    if (options.backend == "model")
+    {
+        target_name = "ipu_model";
+        return createModel(options, num_ipus, num_tiles_per_ipu).createDevice().getTarget();
+    }
+
+    target_name = "ipu";
+    return poplar::Target::createIPUTarget(num_ipus, options.arch);
+}
+
+int compileOnly(
+        GraphOptions options,
+        const DeviceOptions &device_options,
+        unsigned num_tiles_per_ipu,
+        const CompileSettings &settings)
+{
+    std::string target_name;
+    const auto target = createTarget(
+        device_options, options.num_ipus, num_tiles_per_ipu, target_name);
+    options.num_workers = target.getNumWorkerContexts();
+
+    std::string ipu_string = (options.num_ipus > 1) ? "IPUs" : "IPU";
+    std::cout << "Compiling for " << (target_name == "ipu" ? "hardware" : "an IPUModel")
+              << " with " << options.num_ipus << " " << ipu_string << " and "
+              << num_tiles_per_ipu << " tiles per IPU, without running.\n";
+
+    // The executable is stored in the cache, so a later run with the same
+    // options only needs to load it.
+    const auto start = std::chrono::steady_clock::now();
+    bool is_cached;
+    getExecutable(target, options, settings, is_cached, nullptr, true);
+    std::cout << "  Took " << timeIt(start) << " ms\n";
+    std::cout << "Peak host RSS " << peakRss() / (1024 * 1024) << " MB\n";
+
+    std::cout << "Done!\n";
+
+    return 0;
+}
+
+poplar::Executable getExecutable(
+        const poplar::Target &target,
+        const GraphOptions &options,
+        const CompileSettings &settings,
+        bool &is_cached,
+        BuildStats *build,
+        bool verbose)
+{
+    // Describe everything that determines the compiled executable. This is
+    // hashed to form the executable cache key. The target is described by
+    // what is actually compiled for, since e.g. a benchmark models as many
+    // tiles as its largest configuration, and compiling without a device can
+    // be for a different architecture than the one attached.
+    const bool is_model = (target.getTargetType() == poplar::TargetType::IPU_MODEL);
+    std::ostringstream config;
+    config << "poplar: " << poplar::versionString() << '\n'
+           << "target: " << (is_model ? "ipu_model" : "ipu") << ' '
+           << target.getTargetArchString() << ", " << target.getNumIPUs() << " IPUs, "
+           << target.getTilesPerIPU() << " tiles per IPU";
+    if (is_model)
+    {
+        config << ", " << (settings.compile_ipu_code ? "IPU" : "host") << " code";
+    }
+    config << '\n'
+           << "num_ipus: " << options.num_ipus << '\n'
+           << "num_tiles_per_ipu: " << options.num_tiles / options.num_ipus << '\n'
+           << "num_workers: " << options.num_workers << '\n'
+           << "codelet_flags: " << settings.codelet_flags << '\n';
+    if (usesLibraryCodelets(options))
+    {
+        config << "library_codelets: popops\n";
+    }
+    for (const auto &option : settings.engine_options)
+    {
+        config << "option: " << option.first << '=' << option.second << '\n';
+    }
+    config << describeGraph(replicaOptions(options));
+
+    auto sources = settings.codelets;
+    sources.insert(sources.end(), settings.graph_sources.begin(), settings.graph_sources.end());
+    const ExecutableCache cache(settings.cache_dir, config.str(), sources);
+
+    // Try to load a previously compiled graph program from the cache.
+    if (settings.use_cache and not settings.force_compile)
+    {
+        if (auto executable = cache.load())
+        {
+            if (verbose)
+            {
+                std::cout << "\nLoading cached graph program...\n";
+                std::cout << "  " << cache.getPath() << '\n';
+            }
+
+            is_cached = true;
+            return std::move(*executable);
+        }
+    }
+
+    // Build and compile the graph program.
+    if (verbose)
+    {
+        std::cout << "\nCompiling graph program...\n";
+    }
+
+    // Create a Graph object. When replicated, this is the graph for a single
+    // replica, which is compiled once and then copied to each of them. Time
+    // building the graph separately from compiling it.
+    auto start = std::chrono::steady_clock::now();
+    poplar::Graph graph(target, poplar::replication_factor(options.num_replicas));
+
+    BuildStats build_stats;
+    build_stats.codelets = addCodelets(graph, options, settings);
+    if (verbose)
+    {
+        reportCodelets(build_stats.codelets, settings);
+    }
+
+    const auto programs = buildGraph(graph, replicaOptions(options), &build_stats.exchange);
+    build_stats.build_time = timeIt(start);
+
+    if (verbose)
+    {
+        std::cout << "Built graph in " << build_stats.build_time << " ms\n";
+    }
+
+    // Report the data that the vertices need from other tiles.
+    if (verbose)
+    {
+        std::cout << "Tile mapping: " << mappingName(options.mapping) << '\n';
+        for (const auto &[name, stats] : build_stats.exchange)
+        {
+            std::cout << "  " << name << ": " << stats.num_vertices << " vertices, "
+                      << stats.num_edges << " edges, "
+                      << stats.num_cross_tile_edges << " cross-tile, "
+                      << stats.num_bytes << " bytes exchanged\n";
+        }
+    }
+
+    start = std::chrono::steady_clock::now();
+    auto executable = poplar::compileGraph(graph, programs, settings.engine_options);
+    build_stats.compile_time = timeIt(start);
+
+    if (verbose)
+    {
+        std::cout << "Compiled graph in " << build_stats.compile_time << " ms\n";
+    }
+
+    if (build != nullptr)
+    {
+        *build = std::move(build_stats);
+    }
+
+    // Store the executable so that it can be reused by later runs.
+    if (settings.use_cache)
+    {
+        cache.store(executable);
+    }
+
+    is_cached = false;
+    return executable;
+}
+
+std::string describeGraph(const GraphOptions &options)
+{
+    const auto num_workers_total = numElements(options);
+
+    // Describe the add step.
+    std::string add;
+    if (options.runtime_repeats)
+    {
+        add = "copy(num_repeats, counter), repeat_while_true(CountDown(counter), computeSet0)";
+    }
+    else if (options.vertices == VertexLayout::VECTOR)
+    {
+        add = "computeSet0";
+    }
+    else
+    {
+        add = "repeat(" + std::to_string(options.num_repeats) + ", computeSet0)";
+    }
+
+    const auto type = dataTypeName(options.dtype);
+
+    std::ostringstream ss;
+    if (options.num_replicas > 1)
+    {
+        ss << "replicas: " << options.num_replicas << '\n';
+    }
+    const auto mapping = mappingName(options.mapping);
+    if (options.runtime_values)
+    {
+        ss << "values: add, multiply written at runtime, ";
+    }
+    else
+    {
+        // (The values are part of the executable cache key, so are written at
+        // full precision, so that values that only differ past the default
+        // six digits don't share an executable.)
+        ss << std::setprecision(17)
+           << "values: add " << options.add_value << ", multiply " << options.multiply_value << ", "
+           << std::setprecision(6);
+    }
+    ss << constantPlacementName(options.constants) << '\n';
+    ss << "tensor0: " << type << " {" << num_workers_total << "} " << mapping << '\n';
+    if (not options.multiply_sum)
+    {
+        ss << "tensor1: " << type << " {" << num_workers_total << ", "
+           << options.num_columns << "} " << mapping << '\n';
+    }
+    if (options.vertices == VertexLayout::MULTI)
+    {
+        ss << "computeSet0: AddSomethingMulti<" << type << "> x " << options.num_tiles << '\n';
+        if (options.multiply_sum)
+        {
+            ss << "computeSet1: MultiplySumMulti<" << type << ">("
+               << options.num_columns << ") x " << options.num_tiles << '\n'
+               << "computeSet2: empty\n";
+        }
+        else
+        {
+            ss << "computeSet1: MultiplySomethingNumTimesMulti<" << type << "> x " << options.num_tiles << '\n'
+               << "computeSet2: SumMulti<" << type << "> x " << options.num_tiles << '\n';
+        }
+    }
+    else
+    {
+        if (options.vertices == VertexLayout::VECTOR)
+        {
+            ss << "computeSet0: AddSomethingVector<" << type << ">("
+               << (options.runtime_repeats ? 1 : options.num_repeats) << " repeats) per worker, "
+               << "64-bit grains\n";
+        }
+        else
+        {
+            ss << "computeSet0: AddSomething<" << type << "> x " << num_workers_total << '\n';
+        }
+        if (options.multiply_sum)
+        {
+            ss << "computeSet1: MultiplySum<" << type << ">("
+               << options.num_columns << ") x " << num_workers_total << '\n'
+               << "computeSet2: empty\n";
+        }
+        else
+        {
+            ss << "computeSet1: MultiplySomethingNumTimes<" << type << "> x " << num_workers_total << '\n'
+               << "computeSet2: Sum<" << type << "> x " << num_workers_total << '\n';
+        }
+    }
+    ss << "programs: cycle_stamp(copy_input), cycle_stamp(" << add << "), "
+       << "cycle_stamp(computeSet1), cycle_stamp(computeSet2), cycle_stamp(copy_output)\n";
+    if (options.num_batches > 0)
+    {
+        ss << "stream_batches: repeat(" << options.num_batches << ", copy_input, "
+           << add << ", computeSet1, computeSet2, copy_output)\n";
+    }
+    if (options.fused)
+    {
+        ss << "fused: cycle_stamp(copy_input), cycle_stamp(" << add << "), "
+           << "cycle_stamp(computeSet1), cycle_stamp(computeSet2), "
+           << "cycle_stamp(copy_output)\n";
+    }
+    if (options.runtime_repeats)
+    {
+        ss << "add_static: cycle_stamp(repeat(" << static_repeats << ", computeSet0))\n";
+    }
+    if (options.reduce)
+    {
+        ss << "reduce: Reduce<" << type << "> tree, fan-in " << reduction_fan_in << ", levels";
+        for (const auto &level : reductionLevels(options))
+        {
+            ss << ' ' << level;
+        }
+        ss << '\n';
+    }
+
+    return ss.str();
+}
+
+std::size_t numElements(const GraphOptions &options)
+{
+    return std::size_t(options.num_tiles) * options.num_workers * options.elements_per_worker;
+}
+
+unsigned chunkElementsPerWorker(const GraphOptions &options, const poplar::Target &target)
+{
+    // The bytes needed for each element of tensor0 and its row of tensor1.
+    std::size_t num_bytes = typeSize(options.dtype) * (options.multiply_sum ? 1 : 1 + options.num_columns);
+
+    // The scalar and vector layouts also add vertices for each element.
+    if (options.vertices != VertexLayout::MULTI)
+    {
+        const unsigned num_vertices = (options.vertices == VertexLayout::SCALAR ? 1 : 0)
+                                    + (options.multiply_sum ? 1 : 2);
+        num_bytes += num_vertices * vertex_state_bytes;
+    }
+
+    const double num_usable = chunk_memory_fraction * target.getBytesPerTile();
+    return std::max<unsigned>(1, num_usable / (options.num_workers * num_bytes));
+}
+
+GraphOptions replicaOptions(const GraphOptions &options)
+{
+    auto replica = options;
+    replica.num_ipus = options.num_ipus / options.num_replicas;
+    replica.num_tiles = options.num_tiles / options.num_replicas;
+
+    return replica;
+}
+
+std::string vertexLayoutName(VertexLayout layout)
+{
+    switch (layout)
+    {
+        case VertexLayout::VECTOR: return "vector";
+        case VertexLayout::MULTI:  return "multi";
+        default:                   return "scalar";
+    }
+}
+
+std::string mappingName(MappingStrategy mapping)
+{
+    switch (mapping)
+    {
+        case MappingStrategy::WORKER: return "worker";
+        case MappingStrategy::GRAIN:  return "grain";
+        default:                      return "linear";
+    }
+}
+
+std::string constantPlacementName(ConstantPlacement placement)
+{
+    return (placement == ConstantPlacement::PER_TILE) ? "per-tile" : "tile0";
+}
+
+std::string codeletObject(const std::string &source, const std::string &codelet_dir)
+{
+    return (std::filesystem::path(codelet_dir) /
+            std::filesystem::path(source).stem()).string() + ".gp";
+}
+
+bool usesLibraryCodelets(const GraphOptions &options)
+{
+    return options.reduce and (options.num_replicas > 1);
+}
+
+CodeletStats addCodelets(
+        poplar::Graph &graph,
+        const GraphOptions &options,
+        const CompileSettings &settings)
+{
+    const auto start = std::chrono::steady_clock::now();
+
+    CodeletStats stats;
+    for (const auto &source : settings.codelets)
+    {
+        // Use the precompiled object, unless it's missing or out of date.
+        const auto object = codeletObject(source, settings.codelet_dir);
+        std::error_code error;
+        const auto object_time = std::filesystem::last_write_time(object, error);
+        if (not error and (object_time >= std::filesystem::last_write_time(source)))
+        {
+            graph.addCodelets(object);
+            ++stats.num_precompiled;
+        }
+        else
+        {
+            graph.addCodelets(source, settings.codelet_flags);
+            ++stats.num_compiled;
+        }
+    }
+    if (usesLibraryCodelets(options))
+    {
+        popops::addCodelets(graph);
+    }
+    registerCycleEstimators(graph);
+    stats.time = timeIt(start);
+
+    return stats;
+}
+
+void reportCodelets(const CodeletStats &stats, const CompileSettings &settings)
+{
+    const auto record = settings.cache_dir + "/codelets_source_ms";
+
+    if (stats.num_compiled == 0)
+    {
+        std::cout << "Loaded " << stats.num_precompiled << " precompiled codelets in "
+                  << stats.time << " ms";
+
+        // Compare with the last time the codelets were compiled from source.
+        double source_time;
+        std::ifstream file(record);
+        if (file >> source_time)
+        {
+            std::cout << ", saving " << source_time - stats.time
+                      << " ms over compiling them from source";
+        }
+        std::cout << ".\n";
+
+        return;
+    }
+
+    std::cout << "Compiled " << stats.num_compiled << " codelets from source";
+    if (stats.num_precompiled > 0)
+    {
+        std::cout << " and loaded " << stats.num_precompiled << " precompiled codelets";
+    }
+    std::cout << " in " << stats.time << " ms. "
+              << "Run 'make codelets' to precompile them.\n";
+
+    // Record the time taken to compile every codelet from source.
+    if (settings.use_cache and (stats.num_precompiled == 0))
+    {
+        std::error_code error;
+        std::filesystem::create_directories(settings.cache_dir, error);
+        std::ofstream(record) << stats.time << '\n';
+    }
+}
+
+std::vector<poplar::program::Program> buildGraph(
+        poplar::Graph &graph,
+        const GraphOptions &options,
+        ExchangeReport *report)
+{
+    const unsigned num_tiles = options.num_tiles;
+    const unsigned num_workers = options.num_workers;
+    const unsigned num_columns = options.num_columns;
+
+    // The element type of our tensors.
+    const auto type = poplarType(options.dtype);
+
+    // Get the name of the vertex for a templated codelet.
+    auto vertex = [&type](const std::string &name)
+    {
+        return poputil::templateVertex(name, type);
+    };
+
+    // Work out the size of our tensors. (For simplicity, we'll have one element
+    // for each worker on each tile, unless streaming chunks.)
+    const std::size_t num_workers_total = numElements(options);
+
+    // Add constants and variables to the graph.
+
+    // Add a value of our element type that is used by the algorithms. This
+    // is either a scalar, or has one element per tile, so that it can be
+    // broadcast to every tile. When the values are written at runtime, it is
+    // a variable that the host can write to using the handle, otherwise it
+    // is a constant.
+    const bool per_tile_constants = (options.constants == ConstantPlacement::PER_TILE);
+    auto add_constant = [&](double value, const std::string &handle)
+    {
+        const std::vector<std::size_t> shape = per_tile_constants ?
+            std::vector<std::size_t>{num_tiles} : std::vector<std::size_t>{};
+
+        if (options.runtime_values)
+        {
+            auto variable = graph.addVariable(type, shape, handle);
+            graph.createHostWrite(handle, variable);
+            return variable;
+        }
+
+        switch (options.dtype)
+        {
+            case DataType::FLOAT:
+            case DataType::HALF:
+                return graph.addConstant<float>(type, shape, value);
+            case DataType::INT64:
+                return graph.addConstant<long long>(type, shape, static_cast<long long>(value));
+            default:
+                return graph.addConstant<int>(type, shape, static_cast<int>(value));
+        }
+    };
+
+    // Get the copy of a constant to connect to a vertex on a tile.
+    auto on_tile = [per_tile_constants](const poplar::Tensor &constant, unsigned tile)
+    {
+        return per_tile_constants ? constant[tile] : constant;
+    };
+
+    // Add the values to add and multiply by.
+    const auto add_value = add_constant(options.add_value, "add_value");
+    const auto multiply_value = add_constant(options.multiply_value, "multiply_value");
+
+    // Add tensors. These will hold the input and output of our codelets.
+    // The first tensor is used for single-valued input/output.
+    const auto tensor0 = graph.addVariable(
+            type,
+            {num_workers_total},
+            "tensor0");
+    // Add a second, two-dimensional tensor with num_workers rows and num_columns
+    // columns.
+    // This is used for multi-valued input/output. (It isn't needed when the
+    // multiply and sum are fused.)
+    poplar::Tensor tensor1;
+    if (not options.multiply_sum)
+    {
+        tensor1 = graph.addVariable(
+                type,
+                {num_workers_total, num_columns},
+                "tensor1");
+    }
+
+    // Map the constants either to the first tile, or one copy to each tile.
+    // (A single copy is fetched by every tile over the exchange, which is a
+    // broadcast hotspot for large numbers of tiles.)
+    if (per_tile_constants)
+    {
+        for (unsigned tile=0; tile<num_tiles; ++tile)
+        {
+            graph.setTileMapping(add_value[tile], tile);
+            graph.setTileMapping(multiply_value[tile], tile);
+        }
+    }
+    else
+    {
+        graph.setTileMapping(add_value, 0);
+        graph.setTileMapping(multiply_value, 0);
+    }
+
+    // The contiguous range of tensor0 elements whose vertices are placed on
+    // each tile. This is either a block of elements for each worker on each
+    // tile, or whole 64-bit grains spread evenly amongst the tiles.
+    const unsigned grain_size = (options.mapping == MappingStrategy::GRAIN) ?
+        std::max<unsigned>(1, 8 / typeSize(options.dtype)) :
+        num_workers * options.elements_per_worker;
+    const std::uint64_t num_grains = (num_workers_total + grain_size - 1) / grain_size;
+
+    auto grain_start = [&](unsigned tile)
+    {
+        return std::min<std::uint64_t>(
+            num_workers_total, (tile * num_grains / num_tiles) * grain_size);
+    };
+
+    std::vector<std::pair<unsigned, unsigned>> tile_ranges(num_tiles);
+    for (unsigned tile=0; tile<num_tiles; ++tile)
+    {
+        tile_ranges[tile] = {grain_start(tile), grain_start(tile + 1)};
+    }
+
+    if (options.mapping == MappingStrategy::LINEAR)
+    {
+        // Map the tensors linearly to the tiles, i.e. spreading the elements
+        // evenly amongst the tiles. Note that Poplar tensors are row-major,
+        // so the mapping would't work correctly if your data was ordered in
+        // a column-major fashion. Each tensor is mapped independently, so
+        // nothing guarantees that the rows of tensor1 end up on the same tile
+        // as the corresponding elements of tensor0, or that either ends up on
+        // the tile that the vertices for a worker block are placed on.
+        poputil::mapTensorLinearly(graph, tensor0);
+        if (not options.multiply_sum)
+        {
+            poputil::mapTensorLinearly(graph, tensor1);
+        }
+    }
+    else
+    {
+        // Map the elements of tensor0 to the tile that their vertices are
+        // placed on, along with the corresponding rows of tensor1.
+        for (unsigned tile=0; tile<num_tiles; ++tile)
+        {
+            const auto [start, end] = tile_ranges[tile];
+            if (start == end)
+            {
+                continue;
+            }
+
+            graph.setTileMapping(tensor0.slice(start, end), tile);
+            if (not options.multiply_sum)
+            {
+                graph.setTileMapping(tensor1.slice({start, 0}, {end, num_columns}), tile);
+            }
+        }
+    }
+
+    // Work out the tile that owns each region of a tensor, as a list of
+    // [begin, end) intervals sorted by their start, so that we can count the
+    // vertex edges that need data from other tiles. (Storing the owner of
+    // every element would take host memory proportional to the size of the
+    // tensors.)
+    using Owners = std::vector<std::tuple<std::size_t, std::size_t, unsigned>>;
+    auto get_owners = [&graph](const poplar::Tensor &tensor)
+    {
+        Owners owners;
+        const auto mapping = graph.getTileMapping(tensor);
+        for (unsigned tile=0; tile<mapping.size(); ++tile)
+        {
+            for (const auto &interval : mapping[tile])
+            {
+                owners.emplace_back(interval.begin(), interval.end(), tile);
+            }
+        }
+        std::sort(owners.begin(), owners.end());
+        return owners;
+    };
+    const auto owners0 = get_owners(tensor0);
+    const auto owners1 = options.multiply_sum ? Owners() : get_owners(tensor1);
+    const auto constant_owners = get_owners(add_value);
+
+    // Get the index of the copy of a constant used on a tile.
+    auto constant_index = [per_tile_constants](unsigned tile)
+    {
+        return per_tile_constants ? tile : 0;
+    };
+
+    // The exchange statistics for each compute set.
+    ExchangeStats add_stats;
+    ExchangeStats multiply_stats;
+    ExchangeStats sum_stats;
+
+    // Record an edge between a vertex on a tile and the elements [start, end)
+    // of a tensor with the given owners.
+    auto count_edge = [&options](
+            ExchangeStats &stats,
+            unsigned tile,
+            const Owners &owners,
+            std::size_t start,
+            std::size_t end)
+    {
+        // Find the first interval that ends after the start of the range,
+        // then count the elements of each overlapping interval that live on
+        // another tile.
+        auto it = std::upper_bound(owners.begin(), owners.end(), start,
+            [](std::size_t x, const auto &owner) { return x < std::get<1>(owner); });
+
+        std::size_t num_remote = 0;
+        for (; (it != owners.end()) and (std::get<0>(*it) < end); ++it)
+        {
+            const auto &[begin, finish, owner] = *it;
+            if (owner != tile)
+            {
+                num_remote += std::min(end, finish) - std::max(start, begin);
+            }
+        }
+
+        ++stats.num_edges;
+        if (num_remote > 0)
+        {
+            ++stats.num_cross_tile_edges;
+            stats.num_bytes += num_remote * typeSize(options.dtype);
+        }
+    };
+
+    // Record the estimated cycles for a vertex in a compute set on a tile in
+    // the statistics. (These are the same estimates that the registered cycle
+    // estimators give the graph.)
+    auto estimate = [num_tiles](
+            ExchangeStats &stats,
+            unsigned tile,
+            std::uint64_t cycles)
+    {
+        stats.tile_estimates.resize(num_tiles);
+        stats.tile_estimates[tile] += cycles;
+        ++stats.num_vertices;
+    };
+
+    // Create three compute sets to run our "algorithms". (When the multiply
+    // and sum are fused, computeSet2 is left empty.)
+    poplar::ComputeSet computeSet0 = graph.addComputeSet("computeSet0");
+    poplar::ComputeSet computeSet1 = graph.addComputeSet("computeSet1");
+    poplar::ComputeSet computeSet2 = graph.addComputeSet("computeSet2");
+
+    // The number of times to repeat the addition. (When this is written at
+    // runtime, the vector vertices only perform a single addition, and are
+    // run in a loop like the other layouts.)
+    const unsigned num_repeats = options.runtime_repeats ? 1 : options.num_repeats;
+
+    // When using vector vertices, split the elements on each tile into
+    // contiguous ranges, with one AddSomethingVector vertex per worker. The
+    // ranges are a multiple of 64 bits, so that the vertex can use 64-bit
+    // loads and stores. The repeats are run inside the vertex.
+    if (options.vertices == VertexLayout::VECTOR)
+    {
+        const unsigned grain_size = std::max<unsigned>(1, 8 / typeSize(options.dtype));
+
+        for (unsigned tile=0; tile<num_tiles; ++tile)
+        {
+            // The elements whose vertices are placed on this tile.
+            const auto [tile_start, tile_end] = tile_ranges[tile];
+
+            // Work out the number of elements per worker, rounded up to a
+            // multiple of the grain size.
+            const unsigned num_grains = (tile_end - tile_start + grain_size - 1) / grain_size;
+            const unsigned grains_per_worker = (num_grains + num_workers - 1) / num_workers;
+            const unsigned elements_per_worker = grains_per_worker * grain_size;
+
+            for (unsigned start=tile_start; start<tile_end; start+=elements_per_worker)
+            {
+                const unsigned end = std::min(start + elements_per_worker, tile_end);
+
+                poplar::VertexRef vtx = graph.addVertex(computeSet0, vertex("AddSomethingVector"));
+                graph.connect(vtx["something"], on_tile(add_value, tile));
+                graph.connect(vtx["input_output"], tensor0.slice(start, end));
+                graph.setInitialValue(vtx["num_repeats"], num_repeats);
+                graph.setTileMapping(vtx, tile);
+                estimate(add_stats, tile,
+                    addSomethingVectorCycles(options.dtype, end - start, num_repeats));
+
+                count_edge(add_stats, tile, constant_owners, constant_index(tile), constant_index(tile) + 1);
+                count_edge(add_stats, tile, owners0, start, end);
+            }
+        }
+    }
+
+    // When using multi-vertices, add a single vertex per tile for each
+    // algorithm, connected to all of the elements on the tile. The work is
+    // split between the workers inside the vertex.
+    if (options.vertices == VertexLayout::MULTI)
+    {
+        for (unsigned tile=0; tile<num_tiles; ++tile)
+        {
+            // The elements whose vertices are placed on this tile.
+            const auto [start, end] = tile_ranges[tile];
+            if (start == end)
+            {
+                continue;
+            }
+            const auto slice0 = tensor0.slice(start, end);
+
+            // Add.
+            poplar::VertexRef vtx0 = graph.addVertex(
+                computeSet0, vertex("AddSomethingMulti"));
+            graph.connect(vtx0["something"], on_tile(add_value, tile));
+            graph.connect(vtx0["input_output"], slice0);
+            graph.setTileMapping(vtx0, tile);
+            estimate(add_stats, tile,
+                addSomethingMultiCycles(options.dtype, end - start, num_workers));
+
+            count_edge(add_stats, tile, constant_owners, constant_index(tile), constant_index(tile) + 1);
+            count_edge(add_stats, tile, owners0, start, end);
+
+            // Fused multiply and sum.
+            if (options.multiply_sum)
+            {
+                poplar::VertexRef vtx1 = graph.addVertex(
+                    computeSet1, vertex("MultiplySumMulti"));
+                graph.connect(vtx1["something"], on_tile(multiply_value, tile));
+                graph.connect(vtx1["input_output"], slice0);
+                graph.setInitialValue(vtx1["num"], num_columns);
+                graph.setTileMapping(vtx1, tile);
+                estimate(multiply_stats, tile,
+                    multiplySumMultiCycles(options.dtype, end - start, num_columns, num_workers));
+
+                count_edge(multiply_stats, tile, constant_owners, constant_index(tile), constant_index(tile) + 1);
+                count_edge(multiply_stats, tile, owners0, start, end);
+                continue;
+            }
+
+            const auto slice1 = tensor1.slice({start, 0}, {end, num_columns}).flatten();
+
+            poplar::VertexRef vtx1 = graph.addVertex(
+                computeSet1, vertex("MultiplySomethingNumTimesMulti"));
+            poplar::VertexRef vtx2 = graph.addVertex(
+                computeSet2, vertex("SumMulti"));
+
+            // Repeat multiply.
+            graph.connect(vtx1["something"], on_tile(multiply_value, tile));
+            graph.connect(vtx1["input"], slice0);
+            graph.connect(vtx1["output"], slice1);
+
+            // Sum.
+            graph.connect(vtx2["input"], slice1);
+            graph.connect(vtx2["output"], slice0);
+
+            // Map the vertices to the tile.
+            graph.setTileMapping(vtx1, tile);
+            graph.setTileMapping(vtx2, tile);
+
+            // Record the estimated cycles.
+            estimate(multiply_stats, tile, multiplySomethingNumTimesMultiCycles(
+                options.dtype, end - start, num_columns, num_workers));
+            estimate(sum_stats, tile,
+                sumMultiCycles(options.dtype, end - start, num_columns, num_workers));
+
+            count_edge(multiply_stats, tile, constant_owners, constant_index(tile), constant_index(tile) + 1);
+            count_edge(multiply_stats, tile, owners0, start, end);
+            count_edge(multiply_stats, tile, owners1, start * num_columns, end * num_columns);
+            count_edge(sum_stats, tile, owners1, start * num_columns, end * num_columns);
+            count_edge(sum_stats, tile, owners0, start, end);
+        }
+    }
+    // Otherwise, add a vertex per element for the multiply and sum (and the
+    // add, when using scalar vertices.)
+    else
+    {
+        for (unsigned tile=0; tile<num_tiles; ++tile)
+        {
+            for (unsigned i=tile_ranges[tile].first; i<tile_ranges[tile].second; ++i)
+            {
+                // Add.
+                if (options.vertices == VertexLayout::SCALAR)
+                {
+                    poplar::VertexRef vtx0 = graph.addVertex(computeSet0, vertex("AddSomething"));
+                    graph.connect(vtx0["something"], on_tile(add_value, tile));
+                    graph.connect(vtx0["input_output"], tensor0[i]);
+                    graph.setTileMapping(vtx0, tile);
+                    estimate(add_stats, tile, addSomethingCycles(options.dtype));
+
+                    count_edge(add_stats, tile, constant_owners, constant_index(tile), constant_index(tile) + 1);
+                    count_edge(add_stats, tile, owners0, i, i+1);
+                }
+
+                // Fused multiply and sum.
+                if (options.multiply_sum)
+                {
+                    poplar::VertexRef vtx1 = graph.addVertex(computeSet1, vertex("MultiplySum"));
+                    graph.connect(vtx1["something"], on_tile(multiply_value, tile));
+                    graph.connect(vtx1["input_output"], tensor0[i]);
+                    graph.setInitialValue(vtx1["num"], num_columns);
+                    graph.setTileMapping(vtx1, tile);
+                    estimate(multiply_stats, tile, multiplySumCycles(options.dtype, num_columns));
+
+                    count_edge(multiply_stats, tile, constant_owners, constant_index(tile), constant_index(tile) + 1);
+                    count_edge(multiply_stats, tile, owners0, i, i+1);
+                    continue;
+                }
+
+                // Create a vertex for each codelet.
+                poplar::VertexRef vtx1 = graph.addVertex(
+                    computeSet1, vertex("MultiplySomethingNumTimes"));
+                poplar::VertexRef vtx2 = graph.addVertex(
+                    computeSet2, vertex("Sum"));
+
+                // Connect vertex inputs and outputs to the appropriate tensors.
+                // (Take the row of 2D tensor1 once, as a 1D tensor, and use it
+                // for both vertices.)
+                const auto row = tensor1[i];
+
+                // Repeat multiply.
+                graph.connect(vtx1["something"], on_tile(multiply_value, tile));
+                graph.connect(vtx1["input"],  tensor0[i]);
+                graph.connect(vtx1["output"], row);
+
+                // Sum.
+                graph.connect(vtx2["input"], row);
+                graph.connect(vtx2["output"], tensor0[i]);
+
+                // Map the vertices to the tile.
+                graph.setTileMapping(vtx1, tile);
+                graph.setTileMapping(vtx2, tile);
+
+                // Record the estimated cycles.
+                estimate(multiply_stats, tile,
+                    multiplySomethingNumTimesCycles(options.dtype, num_columns));
+                estimate(sum_stats, tile, sumCycles(options.dtype, num_columns));
+
+                count_edge(multiply_stats, tile, constant_owners, constant_index(tile), constant_index(tile) + 1);
+                count_edge(multiply_stats, tile, owners0, i, i+1);
+                count_edge(multiply_stats, tile, owners1, i * num_columns, (i+1) * num_columns);
+                count_edge(sum_stats, tile, owners1, i * num_columns, (i+1) * num_columns);
+                count_edge(sum_stats, tile, owners0, i, i+1);
+            }
+        }
+    }
+
+    if (report != nullptr)
+    {
+        *report = {
+            {"add", add_stats},
+            {"multiply", multiply_stats},
+            {"sum", sum_stats}
+        };
+    }
+
+    // Create a vector to store our programs.
+    std::vector<poplar::program::Program> programs;
+
+    // Create host-to-IPU data stream and associated copy program.
+    auto input_write = graph.addHostToDeviceFIFO(
+            "input_write",
+            type,
+            num_workers_total);
+    auto copy_input = poplar::program::Copy(input_write, tensor0);
+
+    // Create IPU-to-host data stream and associated copy program.
+    auto output_read = graph.addDeviceToHostFIFO(
+            "output_read",
+            type,
+            num_workers_total);
+    auto copy_output = poplar::program::Copy(tensor0, output_read);
+
+    // Add the host-to-IPU copy program.
+    programs.push_back(instrument(graph, copy_input, "copy_input_cycles", num_tiles));
+
+    // Create a program to repeat the addition. (The vector vertices
+    // run the repeats themselves.)
+    auto add_sequence = poplar::program::Sequence();
+    if (options.runtime_repeats)
+    {
+        // The number of repeats is written by the host, and copied to a
+        // counter at the start of each run. Each iteration of the loop runs a
+        // CountDown vertex that decrements the counter and sets the
+        // predicate, then the add compute set if it is still true.
+        const auto repeats = graph.addVariable(poplar::UNSIGNED_INT, {}, "num_repeats");
+        const auto counter = graph.addVariable(poplar::UNSIGNED_INT, {}, "repeat_counter");
+        const auto predicate = graph.addVariable(poplar::UNSIGNED_INT, {}, "repeat_predicate");
+        graph.setTileMapping(repeats, 0);
+        graph.setTileMapping(counter, 0);
+        graph.setTileMapping(predicate, 0);
+        graph.createHostWrite("num_repeats", repeats);
+
+        auto count_down = graph.addComputeSet("countDown");
+        poplar::VertexRef vtx = graph.addVertex(count_down, "CountDown");
+        graph.connect(vtx["counter"], counter);
+        graph.connect(vtx["predicate"], predicate);
+        graph.setTileMapping(vtx, 0);
+
+        add_sequence.add(poplar::program::Copy(repeats, counter));
+        add_sequence.add(poplar::program::RepeatWhileTrue(
+            poplar::program::Execute(count_down),
+            predicate,
+            poplar::program::Execute(computeSet0)
+        ));
+    }
+    else if (options.vertices == VertexLayout::VECTOR)
+    {
+        add_sequence.add(poplar::program::Execute(computeSet0));
+    }
+    else
+    {
+        add_sequence.add(poplar::program::Repeat(
+            num_repeats,
+            poplar::program::Execute(computeSet0)
+        ));
+    }
+
+    // Add the compute sets for our "algorithms".
+    programs.push_back(instrument(
+        graph, add_sequence, "add_cycles", num_tiles));
+    programs.push_back(instrument(
+        graph, poplar::program::Execute(computeSet1), "multiply_cycles", num_tiles));
+    programs.push_back(instrument(
+        graph, poplar::program::Execute(computeSet2), "sum_cycles", num_tiles));
+
+    // Add the IPU-to-host copy program.
+    programs.push_back(instrument(graph, copy_output, "copy_output_cycles", num_tiles));
+
+    // Add a program that streams batches through the device, fusing all of
+    // the steps above into a single on-device loop so that the host doesn't
+    // need to launch each of them separately. (Optional programs are replaced
+    // by an empty sequence when disabled, so that the program indices don't
+    // change.)
+    if (options.num_batches > 0)
+    {
+        programs.push_back(poplar::program::Repeat(
+            options.num_batches,
+            poplar::program::Sequence
+            {
+                copy_input,
+                add_sequence,
+                poplar::program::Execute(computeSet1),
+                poplar::program::Execute(computeSet2),
+                copy_output
+            }
+        ));
+    }
+    else
+    {
+        programs.push_back(poplar::program::Sequence());
+    }
+
+    // Add a program that runs all of the steps in a single dispatch, avoiding
+    // the host-side launch and synchronisation overhead of each engine.run.
+    // Each phase is instrumented separately, so the cycles can be read back
+    // from the host afterwards.
+    if (options.fused)
+    {
+        const std::vector<poplar::program::Program> phases = {
+            copy_input,
+            add_sequence,
+            poplar::program::Execute(computeSet1),
+            poplar::program::Execute(computeSet2),
+            copy_output
+        };
+
+        poplar::program::Sequence fused_sequence;
+        for (unsigned i=0; i<phases.size(); ++i)
+        {
+            fused_sequence.add(instrument(
+                graph, phases[i], "fused_" + phase_names[i] + "_cycles", num_tiles));
+        }
+        programs.push_back(fused_sequence);
+    }
+    else
+    {
+        programs.push_back(poplar::program::Sequence());
+    }
+
+    // Add a program that reduces tensor0 to a single scalar using a tree of
+    // Reduce vertices. The partial sums at each level are mapped to the tile
+    // of the vertex that produces them, and each vertex is placed on the tile
+    // holding the first of its inputs, so each level only needs to exchange
+    // (fan-in - 1) words per vertex. The first level sums the worker results
+    // on each tile, the following levels reduce the tile partials within each
+    // IPU, and the final level combines the results from each IPU. When the
+    // graph is replicated, the results from each replica are then summed by
+    // an all-reduce, so that every replica holds the global sum.
+    if (options.reduce)
+    {
+        const auto levels = reductionLevels(options);
+        const unsigned num_tiles_per_ipu = num_tiles / options.num_ipus;
+
+        poplar::program::Sequence reduce_sequence;
+
+        // Add a compute set for a level of the reduction, where each group
+        // of partials is reduced to a single value on the given tile.
+        auto add_level = [&](
+                const std::string &level,
+                const poplar::Tensor &partials,
+                const std::vector<std::pair<unsigned, unsigned>> &groups,
+                const std::vector<unsigned> &tiles)
+        {
+            const auto name = "reduce_" + level;
+            auto cs = graph.addComputeSet(name);
+            auto result = graph.addVariable(type, {groups.size()}, name);
+
+            for (unsigned i=0; i<groups.size(); ++i)
+            {
+                const auto &group = groups[i];
+
+                poplar::VertexRef vtx = graph.addVertex(cs, vertex("Reduce"));
+                graph.connect(vtx["input"], partials.slice(group.first, group.second));
+                graph.connect(vtx["output"], result[i]);
+                graph.setTileMapping(result[i], tiles[i]);
+                graph.setTileMapping(vtx, tiles[i]);
+            }
+
+            reduce_sequence.add(instrument(
+                graph, poplar::program::Execute(cs), name + "_cycles", num_tiles));
+
+            return result;
+        };
+
+        // The groups of partials to reduce, and the tile of each result.
+        std::vector<std::pair<unsigned, unsigned>> groups;
+        std::vector<unsigned> tiles;
+
+        // Reduce the worker results on each tile.
+        for (unsigned tile=0; tile<num_tiles; ++tile)
+        {
+            groups.emplace_back(tile_ranges[tile].first, tile_ranges[tile].second);
+            tiles.push_back(tile);
+        }
+        auto partials = add_level(levels[0], tensor0, groups, tiles);
+
+        // Reduce the tile partials within each IPU.
+        auto partials_per_ipu = num_tiles_per_ipu;
+        unsigned level = 1;
+        while (partials_per_ipu > 1)
+        {
+            const auto num_groups = (partials_per_ipu + reduction_fan_in - 1) / reduction_fan_in;
+
+            std::vector<unsigned> next_tiles;
+            groups.clear();
+            for (unsigned ipu=0; ipu<options.num_ipus; ++ipu)
+            {
+                const auto offset = ipu * partials_per_ipu;
+                for (unsigned i=0; i<num_groups; ++i)
+                {
+                    const auto begin = offset + i * reduction_fan_in;
+                    const auto end = std::min(begin + reduction_fan_in, offset + partials_per_ipu);
+                    groups.emplace_back(begin, end);
+                    next_tiles.push_back(tiles[begin]);
+                }
+            }
+            tiles = next_tiles;
+
+            partials = add_level(levels[level++], partials, groups, tiles);
+            partials_per_ipu = num_groups;
+        }
+
+        // Combine the results from each IPU on the first tile.
+        if (options.num_ipus > 1)
+        {
+            partials = add_level(levels[level], partials, {{0, options.num_ipus}}, {0});
+        }
+
+        // Sum the results across the replicas.
+        if (options.num_replicas > 1)
+        {
+            poplar::program::Sequence all_reduce;
+            partials = gcl::allReduceCrossReplica(
+                graph, partials, gcl::CollectiveOperator::ADD, all_reduce, "reduce_cross_replica");
+            reduce_sequence.add(instrument(
+                graph, all_reduce, "reduce_cross_replica_cycles", num_tiles));
+        }
+
+        graph.createHostRead("global_sum", partials);
+        programs.push_back(reduce_sequence);
+    }
+    else
+    {
+        programs.push_back(poplar::program::Sequence());
+    }
+
+    // Add a static Repeat of the add compute set, used to measure the
+    // overhead of the runtime loop.
+    if (options.runtime_repeats)
+    {
+        programs.push_back(instrument(
+            graph,
+            poplar::program::Repeat(static_repeats, poplar::program::Execute(computeSet0)),
+            "add_static_cycles",
+            num_tiles));
+    }
+    else
+    {
+        programs.push_back(poplar::program::Sequence());
+    }
+
+    return programs;
+}
+
+std::vector<std::string> reductionLevels(const GraphOptions &options)
+{
+    std::vector<std::string> levels = {"tile"};
+
+    auto partials_per_ipu = options.num_tiles / options.num_ipus;
+    for (unsigned level=1; partials_per_ipu > 1; ++level)
+    {
+        levels.push_back("ipu" + std::to_string(level));
+        partials_per_ipu = (partials_per_ipu + reduction_fan_in - 1) / reduction_fan_in;
+    }
+
+    if (options.num_ipus > 1)
+    {
+        levels.push_back("cross_ipu");
+    }
+
+    if (options.num_replicas > 1)
+    {
+        levels.push_back("cross_replica");
+    }
+
+    return levels;
+}
+
+poplar::program::Sequence instrument(
+        poplar::Graph &graph,
+        const poplar::program::Program &program,
+        const std::string &handle,
+        unsigned num_tiles)
+{
+    std::vector<unsigned> tiles(num_tiles);
+    std::iota(tiles.begin(), tiles.end(), 0);
+
+    poplar::program::Sequence sequence;
+
+    // Synchronise the tiles before taking the start stamps, so that they all
+    // start together.
+    auto stamps = poplar::cycleStamp(
+        graph, sequence, tiles, poplar::SyncType::INTERNAL, handle + "_start");
+
+    sequence.add(program);
+
+    // Don't synchronise before taking the end stamps, so that each tile
+    // records the time at which it finished, exposing any load imbalance.
+    const auto end = poplar::cycleStamp(
+        graph, sequence, tiles, poplar::SyncType::NONE, handle + "_end");
+
+    // Store the start and end stamps for each tile in turn. (The stamps from
+    // every replica of a replicated graph are read back one after the other,
+    // so this layout lets them be treated as one larger set of tiles.)
+    std::vector<poplar::Tensor> pairs;
+    for (unsigned i=0; i<num_tiles; ++i)
+    {
+        pairs.push_back(stamps[i]);
+        pairs.push_back(end[i]);
+    }
+    graph.createHostRead(handle, poplar::concat(pairs));
+
+    return sequence;
+}
+
+std::future<double> loadAsync(poplar::Engine &engine, poplar::Device &device)
+{
+    return std::async(std::launch::async, [&engine, &device]
+    {
+        const auto start = std::chrono::steady_clock::now();
+        engine.load(device);
+        return timeIt(start);
+    });
+}
+
+std::future<CompiledProgram> loadProgramAsync(
+        poplar::Device &device,
+        const GraphOptions &options,
+        const CompileSettings &settings)
+{
+    return std::async(std::launch::async, [&device, &settings, options]
+    {
+        auto start = std::chrono::steady_clock::now();
+        bool is_cached;
+        BuildStats build;
+        auto executable = getExecutable(
+            device.getTarget(), options, settings, is_cached, &build, true);
+
+        CompiledProgram program{
+            std::make_unique<poplar::Engine>(std::move(executable), settings.engine_options),
+            is_cached,
+            timeIt(start)
+        };
+        program.build = std::move(build);
+
+        start = std::chrono::steady_clock::now();
+        program.engine->load(device);
+        program.load_time = timeIt(start);
+
+        return program;
+    });
+}
+
+CycleStats readCycles(
+        poplar::Engine &engine,
+        const std::string &handle,
+        unsigned num_tiles)
+{
+    // Each stamp is stored as a pair of 32-bit unsigned integers, with the
+    // lower word first.
+    std::vector<std::uint32_t> words(4*num_tiles);
+    engine.readTensor(handle, words.data(), words.data() + words.size());
+
+    auto stamp = [&words](unsigned i)
+    {
+        return (std::uint64_t(words[2*i+1]) << 32) | words[2*i];
+    };
+
+    std::uint64_t min = std::numeric_limits<std::uint64_t>::max();
+    std::uint64_t max = 0;
+    double mean = 0;
+    for (unsigned i=0; i<num_tiles; ++i)
+    {
+        const auto cycles = stamp(2*i + 1) - stamp(2*i);
+        min = std::min(min, cycles);
+        max = std::max(max, cycles);
+        mean += cycles;
+    }
+    mean /= num_tiles;
+
+    return {min, mean, max};
+}
+
+CycleStats reportCycles(
+        poplar::Engine &engine,
+        const std::string &handle,
+        unsigned num_tiles,
+        double clock_frequency)
+{
+    const auto cycles = readCycles(engine, handle, num_tiles);
+
+    std::cout << "  Cycles per tile: min " << cycles.min
+              << ", mean " << cycles.mean
+              << ", max " << cycles.max
+              << " (" << 1e3 * cycles.max / clock_frequency << " ms)\n";
+
+    return cycles;
+}
+
+void runSteps(
+        poplar::Engine &engine,
+        unsigned num_tiles,
+        double clock_frequency,
+        PerformanceReport *report)
+{
+    // The messages to print for each step.
+    const std::vector<std::string> messages = {
+        "Copying input data to IPU...",
+        "Running repeat add program...",
+        "Running multiply / clone program...",
+        "Running sum program...",
+        "Copying ouput data from IPU..."
+    };
+
+    for (unsigned i=0; i<phase_names.size(); ++i)
+    {
+        std::cout << messages[i] << '\n';
+        const auto start = std::chrono::steady_clock::now();
+        engine.run(Program::COPY_TO_IPU + i);
+        const auto host_time = timeIt(start);
+        std::cout << "  Took " << host_time << " ms (host)\n";
+
+        const auto cycles = reportCycles(
+            engine, phase_names[i] + "_cycles", num_tiles, clock_frequency);
+        recordPhase(report, phase_names[i], host_time, cycles);
+    }
+}
+
+void runFused(
+        poplar::Engine &engine,
+        unsigned num_tiles,
+        double clock_frequency,
+        PerformanceReport *report)
+{
+    // Run the entire graph program in a single dispatch.
+    std::cout << "Running fused program...\n";
+    const auto start = std::chrono::steady_clock::now();
+    engine.run(Program::FUSED);
+    const auto host_time = timeIt(start);
+    std::cout << "  Took " << host_time << " ms (host)\n";
+
+    // Report the cycles for each phase. (The host time is only known for the
+    // program as a whole.)
+    std::uint64_t total = 0;
+    for (const auto &phase : phase_names)
+    {
+        std::cout << phase << ":\n";
+        const auto cycles = reportCycles(
+            engine, "fused_" + phase + "_cycles", num_tiles, clock_frequency);
+        recordPhase(report, "fused_" + phase, NAN, cycles);
+        total += cycles.max;
+    }
+    recordPhase(report, "fused", host_time, {total, double(total), total});
+    std::cout << "Total: " << total << " cycles ("
+              << 1e3 * total / clock_frequency << " ms)\n";
+}
+
+double runReduce(
+        poplar::Engine &engine,
+        const GraphOptions &options,
+        const poplar::Target &target,
+        PerformanceReport *report)
+{
+    const auto clock_frequency = target.getTileClockFrequency();
+
+    std::cout << "Running global reduction...\n";
+    const auto start = std::chrono::steady_clock::now();
+    engine.run(Program::REDUCE);
+    const auto host_time = timeIt(start);
+    std::cout << "  Took " << host_time << " ms (host)\n";
+
+    // Report the cycles for each level.
+    std::uint64_t total = 0;
+    for (const auto &level : reductionLevels(replicaOptions(options)))
+    {
+        std::cout << level << ":\n";
+        const auto cycles = reportCycles(
+            engine, "reduce_" + level + "_cycles", options.num_tiles, clock_frequency);
+        recordPhase(report, "reduce_" + level, NAN, cycles);
+        total += cycles.max;
+    }
+    recordPhase(report, "reduce", host_time, {total, double(total), total});
+    std::cout << "Total: " << total << " cycles ("
+              << 1e3 * total / clock_frequency << " ms)\n";
+
+    // Every replica holds a copy of the global sum.
+    std::vector<char> buffer(options.num_replicas * typeSize(options.dtype));
+    engine.readTensor("global_sum", buffer.data(), buffer.data() + buffer.size());
+    const auto sum = readBuffer(options.dtype, target, buffer.data(), 1)[0];
+    std::cout << "  Global sum: " << sum << '\n';
+
+    return sum;
+}
+
+void recordProgram(
+        PerformanceReport &report,
+        const GraphOptions &options,
+        const std::string &target_name,
+        const CompiledProgram &program,
+        double prepare_time,
+        const std::string &profile_path)
+{
+    report.setString("config", "target", target_name);
+    report.setNumber("config", "num_ipus", options.num_ipus);
+    report.setNumber("config", "num_tiles_per_ipu", options.num_tiles / options.num_ipus);
+    report.setNumber("config", "num_tiles", options.num_tiles);
+    report.setNumber("config", "num_workers", options.num_workers);
+    report.setNumber("config", "replicas", options.num_replicas);
+    report.setNumber("config", "width", options.num_columns);
+    report.setNumber("config", "repeats", options.num_repeats);
+    report.setString("config", "dtype", dataTypeName(options.dtype));
+    report.setString("config", "vertices", vertexLayoutName(options.vertices));
+    report.setString("config", "mapping", mappingName(options.mapping));
+    report.setString("config", "constants", constantPlacementName(options.constants));
+    report.setFlag("config", "multiply_sum", options.multiply_sum);
+    report.setFlag("config", "runtime_values", options.runtime_values);
+    report.setFlag("config", "runtime_repeats", options.runtime_repeats);
+    report.setString("config", "graph", describeGraph(replicaOptions(options)));
+
+    report.setFlag("timings_ms", "cached", program.is_cached);
+    report.setNumber("timings_ms", "compile", program.compile_time);
+    if (not program.is_cached)
+    {
+        report.setNumber("timings_ms", "build_graph", program.build.build_time);
+        report.setNumber("timings_ms", "compile_graph", program.build.compile_time);
+    }
+    report.setNumber("timings_ms", "load", program.load_time);
+    report.setNumber("timings_ms", "prepare", prepare_time);
+
+    // The estimated cycles are those of the busiest tile.
+    for (const auto &[name, stats] : program.build.exchange)
+    {
+        const auto &estimates = stats.tile_estimates;
+
+        report.addEntry("compute_sets");
+        report.setString("compute_sets", "name", name);
+        report.setNumber("compute_sets", "vertices", stats.num_vertices);
+        report.setNumber("compute_sets", "edges", stats.num_edges);
+        report.setNumber("compute_sets", "cross_tile_edges", stats.num_cross_tile_edges);
+        report.setNumber("compute_sets", "exchange_bytes", stats.num_bytes);
+        report.setNumber("compute_sets", "estimated_cycles", estimates.empty() ?
+            0 : *std::max_element(estimates.begin(), estimates.end()));
+    }
+
+    // Read the memory used by each tile, including gaps due to alignment,
+    // from the graph profile.
+    const auto profile = pva::openReport(profile_path);
+    std::vector<double> memory;
+    for (const auto &tile : profile.compilation().tiles())
+    {
+        memory.push_back(tile.memory().total().includingGaps());
+    }
+    if (not memory.empty())
+    {
+        report.setString("memory", "graph_profile", profile_path);
+        report.setNumber("memory", "total_bytes",
+            std::accumulate(memory.begin(), memory.end(), 0.0));
+        report.setNumber("memory", "min_bytes_per_tile",
+            *std::min_element(memory.begin(), memory.end()));
+        report.setNumber("memory", "max_bytes_per_tile",
+            *std::max_element(memory.begin(), memory.end()));
+        report.setNumbers("memory", "bytes_per_tile", memory);
+    }
+}
+
+void recordPhase(
+        PerformanceReport *report,
+        const std::string &name,
+        double host_time,
+        const CycleStats &cycles)
+{
+    if (report == nullptr)
+    {
+        return;
+    }
+
+    report->addEntry("phases");
+    report->setString("phases", "name", name);
+    report->setNumber("phases", "host_ms", host_time);
+    report->setNumber("phases", "cycles_min", cycles.min);
+    report->setNumber("phases", "cycles_mean", cycles.mean);
+    report->setNumber("phases", "cycles_max", cycles.max);
+}
+
+void reportEstimates(
+        poplar::Engine &engine,
+        const GraphOptions &options,
+        const ExchangeReport &exchange,
+        const std::string &prefix,
+        PerformanceReport *report)
+{
+    std::cout << "Estimated vs measured cycles for the busiest tile:\n";
+
+    for (const auto &[name, stats] : exchange)
+    {
+        const auto &estimates = stats.tile_estimates;
+        if (estimates.empty())
+        {
+            continue;
+        }
+        const auto estimated = *std::max_element(estimates.begin(), estimates.end());
+
+        // The add step runs the compute set once for each repeat, unless the
+        // vector vertices run the repeats themselves. (The measured cycles
+        // include the overhead of synchronising the tiles, and of the loop.)
+        unsigned num_executions = 1;
+        if ((name == "add") and
+            (options.runtime_repeats or (options.vertices != VertexLayout::VECTOR)))
+        {
+            num_executions = options.num_repeats;
+        }
+        const auto cycles = readCycles(engine, prefix + name + "_cycles", options.num_tiles);
+        const double measured = double(cycles.max) / num_executions;
+
+        std::cout << "  " << name << ": estimated " << estimated
+                  << ", measured " << measured
+                  << " (" << 100.0 * estimated / measured << "%)\n";
 
-// Handy enum to name our programs.
-enum Program
+        if (report != nullptr)
+        {
+            report->addEntry("estimates");
+            report->setString("estimates", "name", name);
+            report->setNumber("estimates", "estimated_cycles", estimated);
+            report->setNumber("estimates", "measured_cycles", measured);
+            report->setNumber("estimates", "ratio", estimated / measured);
+        }
+    }
+}
+
+// Run the graph program using a CPU engine with elements of type T.
+template <typename T>
+int runCpuEngine(const GraphOptions &options, unsigned num_threads)
 {
-    COPY_TO_IPU,
-    ADD_SOMETHING,
-    MULTIPLY_SOMETHING_NUM_TIMES,
-    SUM,
-    COPY_FROM_IPU
-};
+    CpuEngine<T> engine(
+        options.num_tiles,
+        options.num_workers,
+        options.num_columns,
+        options.multiply_sum,
+        num_threads);
+
+    const auto num_elements = engine.size();
+    std::vector<T> buffer_in(num_elements, 0);
+    std::vector<T> buffer_out(num_elements);
+
+    std::string ipu_string = (options.num_ipus > 1) ? "IPUs" : "IPU";
+    std::cout << "Using the CPU backend with " << engine.numThreads()
+              << " threads, emulating " << options.num_ipus << " " << ipu_string
+              << " and " << options.num_tiles / options.num_ipus << " tiles per IPU.\n\n";
+
+    // Run each step, timing it on the host.
+    auto start = std::chrono::steady_clock::now();
+    const auto run_start = start;
 
-// Connect to a device with the requested number of IPUs.
-poplar::Device setIpuDevice(unsigned num_ipus);
+    std::cout << "Copying input data...\n";
+    engine.copyInput(buffer_in.data());
+    std::cout << "  Took " << timeIt(start) << " ms\n";
 
-// Compute the time in milliseconds relative to a starting point.
-double timeIt(const std::chrono::time_point<std::chrono::steady_clock> &start);
+    std::cout << "Running repeat add...\n";
+    start = std::chrono::steady_clock::now();
+    engine.add(static_cast<T>(options.add_value), options.num_repeats);
+    std::cout << "  Took " << timeIt(start) << " ms\n";
 
-int main(int argc, char *argv[])
-{
-    // Specify the number of IPUs and tiles per IPU to use.
-    // These can be overriden from the command-line.
-    unsigned num_ipus = 1;
-    unsigned num_tiles_per_ipu = 2;
+    std::cout << "Running multiply / clone...\n";
+    start = std::chrono::steady_clock::now();
+    engine.multiply(static_cast<T>(options.multiply_value));
+    std::cout << "  Took " << timeIt(start) << " ms\n";
+
+    std::cout << "Running sum...\n";
+    start = std::chrono::steady_clock::now();
+    engine.sum();
+    std::cout << "  Took " << timeIt(start) << " ms\n";
+
+    std::cout << "Copying output data...\n";
+    start = std::chrono::steady_clock::now();
+    engine.copyOutput(buffer_out.data());
+    std::cout << "  Took " << timeIt(start) << " ms\n";
 
-    // Rudimentary command-line argument parsing.
+    const auto elapsed = timeIt(run_start);
+    std::cout << "  Throughput " << 1e3 * num_elements / elapsed << " samples/s\n";
+
+    // Validate the output.
+    std::cout << "Validating output...\n";
+    const auto expected = referenceOutput(options, 0);
+    for (const auto &x : buffer_out)
+    {
+        assert(static_cast<double>(x) == expected);
+    }
 
-    // Get the number of IPUs.
-    if (argc > 1)
+    // Stream batches through the engine, to compare with the sustained
+    // throughput of the IPU.
+    if (options.num_batches > 0)
     {
-        std::string s(argv[1]);
+        std::cout << "Streaming " << options.num_batches << " batches of "
+                  << num_elements << " samples...\n";
 
-        try
+        unsigned num_failed = 0;
+        start = std::chrono::steady_clock::now();
+        for (unsigned b=0; b<options.num_batches; ++b)
         {
-            std::size_t pos;
-            num_ipus = std::stoi(s, &pos);
-            if (pos < s.size())
+            const double input = b % 1000;
+            std::fill(buffer_in.begin(), buffer_in.end(), static_cast<T>(input));
+
+            engine.copyInput(buffer_in.data());
+            engine.add(static_cast<T>(options.add_value), options.num_repeats);
+            engine.multiply(static_cast<T>(options.multiply_value));
+            engine.sum();
+            engine.copyOutput(buffer_out.data());
+
+            const auto expected = referenceOutput(options, input);
+            for (const auto &x : buffer_out)
             {
-                std::cerr << "Trailing characters after number of IPUs: " << s << '\n';
-                exit(-1);
+                if (static_cast<double>(x) != expected)
+                {
+                    ++num_failed;
+                    break;
+                }
             }
         }
-        catch (std::invalid_argument const &ex)
+        const auto elapsed = timeIt(start);
+
+        const double num_samples = double(options.num_batches) * num_elements;
+        std::cout << "  Took " << elapsed << " ms\n";
+        std::cout << "  Throughput " << 1e3 * num_samples / elapsed << " samples/s, "
+                  << 2e-6 * num_samples * sizeof(T) / elapsed << " GB/s (in + out)\n";
+
+        if (num_failed > 0)
         {
-            std::cerr << "Invalid number of IPUs: " << s << '\n';
-            exit(-1);
+            std::cerr << num_failed << " of " << options.num_batches
+                      << " batches failed validation!\n";
+            return -1;
         }
-        catch (std::out_of_range const &ex)
+    }
+
+    std::cout << "Done!\n";
+
+    return 0;
+}
+
+int runCpu(const GraphOptions &options, unsigned num_threads)
+{
+    switch (options.dtype)
+    {
+        case DataType::INT:
+            return runCpuEngine<int>(options, num_threads);
+        case DataType::FLOAT:
+            return runCpuEngine<float>(options, num_threads);
+        case DataType::INT64:
+            return runCpuEngine<long long>(options, num_threads);
+        default:
+            std::cerr << "The CPU backend doesn't support the '"
+                      << dataTypeName(options.dtype) << "' data type!\n";
+            return -1;
+    }
+}
+
+void connectStreams(
+        poplar::Engine &engine,
+        const GraphOptions &options,
+        char *buffer_in,
+        char *buffer_out)
+{
+    const std::size_t replica_size = std::size_t(options.num_tiles / options.num_replicas) *
+        options.num_workers * typeSize(options.dtype);
+
+    for (unsigned replica=0; replica<options.num_replicas; ++replica)
+    {
+        const auto offset = replica * replica_size;
+        engine.connectStream("input_write", replica,
+            buffer_in + offset, buffer_in + offset + replica_size);
+        engine.connectStream("output_read", replica,
+            buffer_out + offset, buffer_out + offset + replica_size);
+    }
+}
+
+void writeValues(
+        poplar::Engine &engine,
+        const GraphOptions &options,
+        const poplar::Target &target)
+{
+    // There is a copy of each value for every tile when the constants are
+    // placed per tile, otherwise one for each replica.
+    const std::size_t num_copies =
+        (options.constants == ConstantPlacement::PER_TILE) ? options.num_tiles : options.num_replicas;
+    std::vector<char> buffer(num_copies * typeSize(options.dtype));
+
+    fillBuffer(options.dtype, target, buffer.data(), num_copies, options.add_value);
+    engine.writeTensor("add_value", buffer.data(), buffer.data() + buffer.size());
+
+    fillBuffer(options.dtype, target, buffer.data(), num_copies, options.multiply_value);
+    engine.writeTensor("multiply_value", buffer.data(), buffer.data() + buffer.size());
+}
+
+void writeRepeats(poplar::Engine &engine, const GraphOptions &options)
+{
+    // Each replica has its own copy of the number of repeats.
+    const std::vector<unsigned> num_repeats(options.num_replicas, options.num_repeats);
+    engine.writeTensor("num_repeats", num_repeats.data(), num_repeats.data() + num_repeats.size());
+}
+
+void reportLoopOverhead(
+        poplar::Engine &engine,
+        const GraphOptions &options,
+        const std::string &add_handle,
+        double clock_frequency)
+{
+    const auto runtime_cycles = readCycles(engine, add_handle, options.num_tiles).max;
+
+    std::cout << "Running static add loop...\n";
+    engine.run(Program::ADD_STATIC);
+    const auto static_cycles = reportCycles(
+        engine, "add_static_cycles", options.num_tiles, clock_frequency).max;
+
+    // Work out the cycles per iteration of each loop. (The runtime loop also
+    // includes the copy of the number of repeats to the counter.)
+    const double static_per_iteration = double(static_cycles) / static_repeats;
+    const double runtime_per_iteration = double(runtime_cycles) / std::max(1u, options.num_repeats);
+
+    std::cout << "Loop overhead:\n"
+              << "  Static Repeat: " << static_per_iteration << " cycles per iteration\n"
+              << "  Runtime RepeatWhileTrue: " << runtime_per_iteration
+              << " cycles per iteration (+" << runtime_per_iteration - static_per_iteration
+              << ")\n";
+}
+
+unsigned runValueSets(
+        poplar::Engine &engine,
+        const GraphOptions &options,
+        const poplar::Target &target,
+        unsigned num_sets,
+        double compile_time)
+{
+    const auto num_workers_total = options.num_tiles * options.num_workers;
+    const auto dtype = options.dtype;
+
+    // Create buffers to hold our input/output, zeroing the input buffer.
+    std::vector<char> buffer_in(num_workers_total * typeSize(dtype));
+    std::vector<char> buffer_out(num_workers_total * typeSize(dtype));
+    fillBuffer(dtype, target, buffer_in.data(), num_workers_total, 0);
+    connectStreams(engine, options, buffer_in.data(), buffer_out.data());
+
+    std::cout << "Running " << num_sets << " sets of values...\n";
+
+    unsigned num_failed = 0;
+    double run_time = 0;
+    for (unsigned k=0; k<num_sets; ++k)
+    {
+        // Vary both values for each set.
+        auto set = options;
+        set.add_value = options.add_value + k;
+        set.multiply_value = options.multiply_value + k % 4;
+
+        // Write the values and run each step, timing only the device work.
+        const auto start = std::chrono::steady_clock::now();
+        writeValues(engine, set, target);
+        for (unsigned i=0; i<phase_names.size(); ++i)
         {
-            std::cerr << "Number of IPUs out of range: " << s << '\n';
-            exit(-1);
+            engine.run(Program::COPY_TO_IPU + i);
         }
+        run_time += timeIt(start);
 
-        // Check against hardcoded limits. Can query device to see what's available.
-        if ((num_ipus < 1) or (num_ipus > 4))
+        const auto output = readBuffer(dtype, target, buffer_out.data(), num_workers_total);
+        const auto expected = referenceOutput(set, 0);
+        if (std::any_of(output.begin(), output.end(),
+            [expected](double x) { return x != expected; }))
         {
-            std::cerr << "Number of IPUs must be between 1 and 4!\n";
-            exit(-1);
+            ++num_failed;
         }
     }
-    // Get the number of tiles per IPU.
-    if (argc > 2)
+
+    std::cout << "  Took " << run_time << " ms (" << run_time / num_sets << " ms per set)\n";
+    std::cout << "  Compiling (or loading) an executable for each set would add "
+              << num_sets * compile_time << " ms\n";
+
+    if (num_failed > 0)
     {
-        std::string s(argv[2]);
+        std::cerr << num_failed << " of " << num_sets
+                  << " sets of values failed validation!\n";
+    }
 
-        try
+    return num_failed;
+}
+
+unsigned runBatches(
+        poplar::Engine &engine,
+        const GraphOptions &options,
+        const poplar::Target &target)
+{
+    const auto num_batches = options.num_batches;
+    const auto batch_size = numElements(options);
+    const auto dtype = options.dtype;
+    const auto num_bytes = batch_size * typeSize(dtype);
+
+    // Double buffers for the input and output streams.
+    DoubleBuffer input(num_bytes);
+    DoubleBuffer output(num_bytes);
+
+    // The input for batch b is a constant value, so the expected output
+    // is (b + add_value*num_repeats)*multiply_value*num_columns, subject to
+    // the precision of the data type.
+    auto input_value = [](unsigned b) { return static_cast<double>(b % 1000); };
+
+    // Connect the streams to the double buffers.
+    engine.connectStreamToCallback(
+        "input_write",
+        std::make_unique<DoubleBufferInputCallback>(input));
+    engine.connectStreamToCallback(
+        "output_read",
+        [&output, num_bytes](void *p)
         {
-            std::size_t pos;
-            num_tiles_per_ipu = std::stoi(s, &pos);
-            if (pos < s.size())
+            if (const auto dst = output.acquireWrite())
             {
-                std::cerr << "Trailing characters after number of tiles: " << s << '\n';
-                exit(-1);
+                std::memcpy(dst, p, num_bytes);
+                output.releaseWrite();
             }
-        }
-        catch (std::invalid_argument const &ex)
-        {
-            std::cerr << "Invalid number of tiles: " << s << '\n';
-            exit(-1);
-        }
-        catch (std::out_of_range const &ex)
+        });
+
+    // Prepare the input batches on a separate thread, so that this overlaps
+    // with the device processing the previous batch.
+    std::thread producer([&]
+    {
+        for (unsigned b=0; b<num_batches; ++b)
         {
-            std::cerr << "Number of tiles out of range: " << s << '\n';
-            exit(-1);
+            const auto p = input.acquireWrite();
+            if (p == nullptr)
+            {
+                return;
+            }
+            fillBuffer(dtype, target, p, batch_size, input_value(b));
+            input.releaseWrite();
         }
+    });
 
-        // Check against hardcoded limits. Can query device to see what's available.
-        if ((num_tiles_per_ipu < 1) or (num_tiles_per_ipu > 1472))
+    // Validate the output batches on a separate thread as they arrive.
+    unsigned num_failed = 0;
+    std::thread consumer([&]
+    {
+        for (unsigned b=0; b<num_batches; ++b)
         {
-            std::cerr << "Number of tiles per IPU must be between 1 and 1472!\n";
-            exit(-1);
+            const auto p = output.acquireRead();
+            if (p == nullptr)
+            {
+                return;
+            }
+            const auto values = readBuffer(dtype, target, p, batch_size);
+            const auto expected = referenceOutput(options, input_value(b));
+            for (unsigned i=0; i<batch_size; ++i)
+            {
+                if (values[i] != expected)
+                {
+                    ++num_failed;
+                    break;
+                }
+            }
+            output.releaseRead();
         }
-    }
+    });
 
-    poplar::Device device;
+    // Close the buffers and join the threads however we leave, so that the
+    // threads don't wait forever for a device that has stopped, and an error
+    // from the run is reported rather than terminating the program. (The
+    // consumer still validates any batches that have arrived.)
+    auto join = [&]
+    {
+        input.close();
+        output.close();
+        producer.join();
+        consumer.join();
+    };
 
-    // Try to connect to a device with the requested number of IPUs.
+    // Run the batches.
+    std::cout << "Streaming " << num_batches << " batches of "
+              << batch_size << " samples...\n";
+    const auto start = std::chrono::steady_clock::now();
     try
     {
-        device = setIpuDevice(num_ipus);
-
-        std::string ipu_string = (num_ipus > 1) ? "IPUs" : "IPU";
-        std::cout << "Using " << num_ipus << " " << ipu_string
-                  << " and " << num_tiles_per_ipu << " tiles per IPU.\n";
+        engine.run(Program::STREAM_BATCHES);
     }
-    // Use an IPUModel as a fallback.
-    catch(...)
+    catch (...)
     {
-        std::string ipu_string = (num_ipus > 1) ? "IPUs" : "IPU";
-        std::cout << "Unable to connect to a device with "
-                  << num_ipus << " " << ipu_string << ".\n";
-        std::cout << "Using an IPUModel with 1 IPU and "
-                  << num_tiles_per_ipu << " tiles per IPU.\n";
-        std::cout << "Ignore timing statistics.\n";
-
-        num_ipus = 1;
-        poplar::IPUModel ipuModel;
-        device = ipuModel.createDevice();
+        join();
+        throw;
     }
+    const auto elapsed = timeIt(start);
+    join();
 
-    // Store the number of hardware workers per tile. We'll make use of all
-    // threads.
-    const unsigned num_workers = device.getTarget().getNumWorkerContexts();
+    // Report the sustained throughput.
+    const double num_samples = double(num_batches) * batch_size;
+    std::cout << "  Took " << elapsed << " ms\n";
+    std::cout << "  Throughput " << 1e3 * num_samples / elapsed << " samples/s, "
+              << 2e-6 * num_samples * typeSize(dtype) / elapsed << " GB/s (in + out)\n";
 
-    // Store the total number of tiles.
-    const unsigned num_tiles = num_ipus * num_tiles_per_ipu;
+    std::cout << "Validating output...\n";
+    if (num_failed > 0)
+    {
+        std::cerr << num_failed << " of " << num_batches
+                  << " batches failed validation!\n";
+    }
 
-    // Create a Graph object.
-    poplar::Graph graph(device);
+    return num_failed;
+}
 
-    // Add codelets.
-    graph.addCodelets({"src/AddSomethingCodelet.cpp",
-                       "src/MultiplySomethingNumTimesCodelet.cpp",
-                       "src/SumCodelet.cpp"},
-                        "-O3");
+unsigned runOutOfCore(
+        poplar::Engine &engine,
+        const GraphOptions &options,
+        const poplar::Target &target,
+        const MappedFile *input_file,
+        MappedFile *output_file)
+{
+    const auto num_chunks = options.num_batches;
+    const auto chunk_size = numElements(options);
+    const auto dtype = options.dtype;
+    const auto chunk_bytes = chunk_size * typeSize(dtype);
+
+    // The size of the input, which for a file needn't be a whole number of
+    // chunks.
+    const std::size_t num_bytes = input_file ?
+        input_file->size() : num_chunks * chunk_bytes;
+    const std::size_t num_samples = num_bytes / typeSize(dtype);
+
+    // The total memory of the tiles, for comparison with the size of the input.
+    const double tile_memory = double(options.num_tiles) * target.getBytesPerTile();
+
+    std::cout << "Streaming " << num_chunks << " chunks of " << chunk_size << " samples ("
+              << options.elements_per_worker << " per worker, "
+              << 1e-6 * chunk_bytes << " MB), "
+              << 1e-9 * num_bytes << " GB in total, "
+              << num_bytes / tile_memory << "x the tile memory...\n";
+
+    // The input for chunk c is a constant value, so the expected output is
+    // (c + add_value*num_repeats)*multiply_value*num_columns, subject to the
+    // precision of the data type.
+    auto input_value = [](unsigned c) { return static_cast<double>(c % 1000); };
+
+    // Validate a chunk of the output at the given offset, which holds n bytes
+    // once any padding is dropped. A generated chunk has a single expected
+    // value. An input file can hold anything, so every sample is checked
+    // against the reference for the matching sample of the input.
+    auto validate = [&](const char *chunk, std::size_t offset, std::size_t n)
+    {
+        // An int64 can't be held exactly by a double, so the values are
+        // compared as integers.
+        if (input_file and (dtype == DataType::INT64))
+        {
+            for (std::size_t i=0; i<n; i+=sizeof(std::int64_t))
+            {
+                std::int64_t value, result;
+                std::memcpy(&value, input_file->data() + offset + i, sizeof(value));
+                std::memcpy(&result, chunk + i, sizeof(result));
+                if (result != integerReference(options, value))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
 
-    // Work out the size of our tensors. (For simplicity, we'll have one element
-    // for each worker on each tile.)
-    const unsigned num_workers_total = num_ipus * num_tiles_per_ipu * num_workers;
+        const auto values = readBuffer(dtype, target, chunk, n / typeSize(dtype));
+        if (input_file)
+        {
+            const auto inputs = readBuffer(dtype, target, input_file->data() + offset, values.size());
+            for (std::size_t i=0; i<values.size(); ++i)
+            {
+                const auto expected = referenceOutput(options, inputs[i]);
+                if ((values[i] != expected) and not (std::isnan(values[i]) and std::isnan(expected)))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
 
-    // Add constants and variables to the graph.
+        const auto expected = referenceOutput(options, input_value(offset / chunk_bytes));
+        return std::all_of(values.begin(), values.end(), [expected](double x) { return x == expected; });
+    };
 
-    // Add a couple of constants.
-    const auto five = graph.addConstant<int>(poplar::INT, {}, 5);
-    const auto ten  = graph.addConstant<int>(poplar::INT, {}, 10);
+    // Copy each chunk straight from the input file, so it is never read into
+    // an intermediate buffer, or generate it in place, so the host only ever
+    // holds the chunk being transferred.
+    ChunkInputCallback::ReadFunction read;
+    if (input_file)
+    {
+        std::cout << "Reading input from " << input_file->getPath() << '\n';
+        read = [input_file](char *p, std::size_t offset, std::size_t n)
+        {
+            std::memcpy(p, input_file->data() + offset, n);
+        };
+    }
+    else
+    {
+        read = [&](char *p, std::size_t offset, std::size_t)
+        {
+            fillBuffer(dtype, target, p, chunk_size, input_value(offset / chunk_bytes));
+        };
+    }
 
-    // Add tensors. These will hold the input and output of our codelets.
-    // The first tensor is used for single-valued input/output.
-    const auto tensor0 = graph.addVariable(
-            poplar::INT,
-            {num_workers_total},
-            "tensor0");
-    // Add a second, two-dimensional tensor with num_workers rows and 20 columns.
-    // This is used for multi-valued input/output.
-    const auto tensor1 = graph.addVariable(
-            poplar::INT,
-            {num_workers_total, 20},
-            "tensor1");
-
-    // Map the constants to the first tile.
-    graph.setTileMapping(five, 0);
-    graph.setTileMapping(ten, 0);
-
-    // Map the tensors linearly to the tiles, i.e. spreading the elements
-    // evenly amongst the tiles. Note that Poplar tensors are row-major,
-    // so the mapping would't work correctly if your data was ordered in
-    // a column-major fashion.
-    poputil::mapTensorLinearly(graph, tensor0);
-    poputil::mapTensorLinearly(graph, tensor1);
-
-    /* Could also do this manually, as shown below.
-    for (unsigned i=0; i<num_tiles; ++i)
+    // Copy each chunk straight into the output file, or, without one,
+    // validate it as it arrives rather than keeping the output on the host.
+    // (The timing then includes the validation.) The padding of the last
+    // chunk is dropped.
+    unsigned num_failed = 0;
+    ChunkOutputCallback::WriteFunction write;
+    if (output_file)
+    {
+        std::cout << "Writing output to " << output_file->getPath() << '\n';
+        write = [output_file](const char *p, std::size_t offset, std::size_t n)
+        {
+            std::memcpy(output_file->data() + offset, p, n);
+        };
+    }
+    else
     {
-        // Map num_workers elements of tensor0 to the tile.
-        graph.setTileMapping(tensor0.slice(num_workers*i, num_workers*(i+1)), i);
+        write = [&](const char *p, std::size_t offset, std::size_t n)
+        {
+            if (not validate(p, offset, n))
+            {
+                ++num_failed;
+            }
+        };
+    }
 
-        // Map 20 columns of num_workers elements from tensor1 to the tile.
-        graph.setTileMapping(tensor1.slice({num_workers*i, 0}, {num_workers*(i+1), 20}), i);
-    }*/
+    engine.connectStreamToCallback(
+        "input_write",
+        std::make_unique<ChunkInputCallback>(num_bytes, chunk_bytes, std::move(read)));
+    engine.connectStreamToCallback(
+        "output_read",
+        ChunkOutputCallback(num_bytes, chunk_bytes, std::move(write)));
 
-    // Create three compute sets to run our "algorithms".
-    poplar::ComputeSet computeSet0 = graph.addComputeSet("computeSet0");
-    poplar::ComputeSet computeSet1 = graph.addComputeSet("computeSet1");
-    poplar::ComputeSet computeSet2 = graph.addComputeSet("computeSet2");
+    // Run the chunks.
+    auto start = std::chrono::steady_clock::now();
+    engine.run(Program::STREAM_BATCHES);
+    const auto elapsed = timeIt(start);
+
+    // Report the end-to-end throughput, i.e. from the input on the host to
+    // the output.
+    std::cout << "  Took " << elapsed << " ms\n";
+    std::cout << "  Throughput " << 1e3 * num_samples / elapsed << " samples/s, "
+              << 2e-6 * num_bytes / elapsed << " GB/s (in + out)\n";
+
+    // For files, also include the time taken to flush the output to disk, to
+    // give the file-to-file throughput.
+    if (output_file)
+    {
+        output_file->sync();
+        const auto total = timeIt(start);
+
+        std::cout << "  Flushed output file after " << total << " ms\n";
+        std::cout << "  File-to-file throughput " << 1e3 * num_samples / total << " samples/s, "
+                  << 2e-6 * num_bytes / total << " GB/s (in + out)\n";
+    }
 
-    // Add vertices to each compute set.
-    for (unsigned i=0; i<num_workers_total; ++i)
+    // Validate the output file, streaming it one chunk at a time.
+    std::cout << "Validating output...\n";
+    if (output_file)
     {
-        // Create a vertex for each codelet.
-        poplar::VertexRef vtx0 = graph.addVertex(computeSet0, "AddSomething");
-        poplar::VertexRef vtx1 = graph.addVertex(computeSet1, "MultiplySomethingNumTimes");
-        poplar::VertexRef vtx2 = graph.addVertex(computeSet2, "Sum");
+        for (std::size_t offset=0; offset<num_bytes; offset+=chunk_bytes)
+        {
+            const auto n = std::min<std::size_t>(chunk_bytes, num_bytes - offset);
+            if (not validate(output_file->data() + offset, offset, n))
+            {
+                ++num_failed;
+            }
+        }
+    }
 
-        // Connect vertex inputs and outputs to the appropriate tensors.
+    if (num_failed > 0)
+    {
+        std::cerr << num_failed << " of " << num_chunks
+                  << " chunks failed validation!\n";
+    }
 
-        // Add.
-        graph.connect(vtx0["something"], five);
-        graph.connect(vtx0["input_output"], tensor0[i]);
+    return num_failed;
+}
 
-        // Repeat multiply.
-        // (Take slice of 2D tensor1 and flatten to a 1D tensor.)
-        graph.connect(vtx1["something"], ten);
-        graph.connect(vtx1["input"],  tensor0[i]);
-        graph.connect(vtx1["output"], tensor1.slice({i, 0}, {i+1, 20}).flatten());
+int runBenchmark(
+        const GraphOptions &base_options,
+        const SweepOptions &sweep,
+        const DeviceOptions &device_options,
+        const CompileSettings &settings)
+{
+    BenchmarkResults results;
+    unsigned num_failed = 0;
 
-        // Sum.
-        // (Take slice of 2D tensor1 and flatten to a 1D tensor.)
-        graph.connect(vtx2["input"], tensor1.slice({i, 0}, {i+1, 20}).flatten());
-        graph.connect(vtx2["output"], tensor0[i]);
+    // An IPUModel only needs to model as many tiles per IPU as the largest
+    // configuration uses.
+    const auto max_tiles_per_ipu = *std::max_element(
+        sweep.num_tiles_per_ipu.begin(), sweep.num_tiles_per_ipu.end());
 
-        // Work out the tile index.
-        const auto tile = std::floor(i / num_workers);
+    // Loop over the number of IPUs first, so that each device is only
+    // attached once.
+    for (const auto num_ipus : sweep.num_ipus)
+    {
+        std::string target_name;
+        auto device = openDevice(device_options, num_ipus, max_tiles_per_ipu, target_name);
 
-        // Map the vertices to the tile.
-        graph.setTileMapping(vtx0, tile);
-        graph.setTileMapping(vtx1, tile);
-        graph.setTileMapping(vtx2, tile);
+        const auto &target = device.getTarget();
+        const auto clock_frequency = target.getTileClockFrequency();
 
-        // Add some crude performance estimates.
-        // (These are only required if running on an IPUModel.)
-        graph.setPerfEstimate(vtx0, 1);
-        graph.setPerfEstimate(vtx1, 120);
-        graph.setPerfEstimate(vtx2, 20);
-    }
+        // Work out the configurations to run on this device.
+        std::vector<GraphOptions> configs;
+        for (const auto num_tiles_per_ipu : sweep.num_tiles_per_ipu)
+        {
+            for (const auto num_columns : sweep.num_columns)
+            {
+                for (const auto num_repeats : sweep.num_repeats)
+                {
+                    for (const bool replicate : sweep.replicate)
+                    {
+                        // A single replica is the same as no replication.
+                        if (replicate and (num_ipus == 1) and (sweep.replicate.size() > 1))
+                        {
+                            continue;
+                        }
+
+                        auto options = base_options;
+                        options.num_ipus = num_ipus;
+                        options.num_tiles = num_ipus * num_tiles_per_ipu;
+                        options.num_replicas = replicate ? num_ipus : 1;
+                        options.num_workers = target.getNumWorkerContexts();
+                        options.num_columns = num_columns;
+                        options.num_repeats = num_repeats;
+                        configs.push_back(options);
+                    }
+                }
+            }
+        }
 
-    // Create a vector to store our programs.
-    std::vector<poplar::program::Program> programs;
+        // Compile the configurations concurrently in a bounded pool, creating
+        // an engine for each. The results are collected in the order in which
+        // they finish, so the first program runs on the device while the
+        // others are still compiling. Each engine holds its executable, so at
+        // most as many engines as threads are held at once, and compilation
+        // pauses while the device falls behind. (Each executable is also
+        // written to the cache, so re-running a sweep skips compilation.)
+        const auto num_compile_threads = std::min<unsigned>(sweep.num_compile_threads, configs.size());
+        TaskPool<CompiledProgram> compiler(num_compile_threads, num_compile_threads);
+        for (const auto &options : configs)
+        {
+            compiler.submit([&target, &settings, options]
+            {
+                const auto start = std::chrono::steady_clock::now();
+                bool is_cached;
+                BuildStats build;
+                auto executable = getExecutable(
+                    target, options, settings, is_cached, &build, false);
+                auto engine = std::make_unique<poplar::Engine>(
+                    std::move(executable), settings.engine_options);
+
+                return CompiledProgram{
+                    std::move(engine), is_cached, timeIt(start), 0, std::move(build)};
+            });
+        }
+        std::cout << "Compiling " << configs.size() << " configurations using "
+                  << compiler.size() << " threads...\n";
 
-    // Create host-to-IPU data stream and associated copy program.
-    auto input_write = graph.addHostToDeviceFIFO(
-            "input_write",
-            poplar::INT,
-            num_workers_total);
-    auto copy_input = poplar::program::Copy(input_write, tensor0);
+        // The measurements for a configuration that has been run on the
+        // device, but whose output hasn't yet been validated and recorded.
+        struct Run
+        {
+            unsigned index;
+            bool is_cached;
+            double compile_time;
+            double build_time;
+            double wait_time;
+            double load_time;
+            double prepare_time;
+            std::vector<double> host_times;
+            std::vector<std::uint64_t> cycles;
+            std::vector<char> buffer_out;
+        };
+
+        // Validate the output of a run and record its results.
+        auto record = [&](const Run &run)
+        {
+            const auto &options = configs[run.index];
+            const unsigned num_workers_total = options.num_tiles * options.num_workers;
+            const auto dtype = options.dtype;
+            const auto &cycles = run.cycles;
+
+            // Validate the output.
+            const auto output = readBuffer(dtype, target, run.buffer_out.data(), num_workers_total);
+            const auto expected = referenceOutput(options, 0);
+            const bool is_valid = std::all_of(output.begin(), output.end(),
+                [expected](double x) { return x == expected; });
+            if (not is_valid)
+            {
+                std::cerr << "Configuration " << run.index << " failed validation!\n";
+                ++num_failed;
+            }
 
-    // Create IPU-to-host data stream and associated copy program.
-    auto output_read = graph.addDeviceToHostFIFO(
-            "output_read",
-            poplar::INT,
-            num_workers_total);
-    auto copy_output = poplar::program::Copy(tensor0, output_read);
+            // Convert cycles to seconds.
+            auto seconds = [clock_frequency](std::uint64_t cycles)
+            {
+                return cycles / clock_frequency;
+            };
+
+            // The number of bytes copied in each direction, and the number of
+            // arithmetic operations performed by the add, multiply and sum.
+            const double num_bytes = double(num_workers_total) * typeSize(dtype);
+            const double num_ops = double(num_workers_total) *
+                (options.num_repeats + 2 * options.num_columns);
+            const auto compute_cycles = cycles[1] + cycles[2] + cycles[3];
+
+            results.addRow();
+            results.setString("target", target_name);
+            results.setFlag("estimated", target_name == "ipu_model");
+            results.setNumber("num_ipus", num_ipus);
+            results.setNumber("num_tiles_per_ipu", options.num_tiles / num_ipus);
+            results.setNumber("num_tiles", options.num_tiles);
+            results.setNumber("replicas", options.num_replicas);
+            results.setNumber("width", options.num_columns);
+            results.setNumber("repeats", options.num_repeats);
+            results.setString("dtype", dataTypeName(dtype));
+            results.setString("vertices", vertexLayoutName(options.vertices));
+            results.setString("mapping", mappingName(options.mapping));
+            results.setString("constants", constantPlacementName(options.constants));
+            results.setNumber("elements", num_workers_total);
+            results.setFlag("cached", run.is_cached);
+            results.setFlag("valid", is_valid);
+            results.setNumber("compile_ms", run.compile_time);
+            results.setNumber("build_ms", run.is_cached ? NAN : run.build_time);
+            results.setNumber("wait_ms", run.wait_time);
+            results.setNumber("load_ms", run.load_time);
+            results.setNumber("prepare_ms", run.prepare_time);
+            for (unsigned i=0; i<cycles.size(); ++i)
+            {
+                results.setNumber(phase_names[i] + "_host_ms", run.host_times[i]);
+            }
+            for (unsigned i=0; i<cycles.size(); ++i)
+            {
+                results.setNumber(phase_names[i] + "_cycles", cycles[i]);
+            }
+            results.setNumber("compute_cycles", compute_cycles);
+            results.setNumber("compute_ms", 1e3 * seconds(compute_cycles));
+            results.setNumber("copy_input_gb_per_s", 1e-9 * num_bytes / seconds(cycles[0]));
+            results.setNumber("copy_output_gb_per_s", 1e-9 * num_bytes / seconds(cycles[4]));
+            results.setNumber("compute_ops_per_s", num_ops / seconds(compute_cycles));
+            results.setNumber("elements_per_s",
+                num_workers_total / seconds(std::accumulate(cycles.begin(), cycles.end(), std::uint64_t(0))));
+        };
+
+        // The previous run, which is recorded while the next program loads.
+        std::optional<Run> previous;
+
+        while (compiler.numPending() > 0)
+        {
+            // Wait for the next program to be ready, recording how long the
+            // device was left idle.
+            auto start = std::chrono::steady_clock::now();
+            unsigned index;
+            CompiledProgram compiled;
+            try
+            {
+                std::tie(index, compiled) = compiler.next();
+            }
+            catch (const std::exception &e)
+            {
+                std::cerr << "Compilation failed: " << e.what() << '\n';
+                ++num_failed;
+                continue;
+            }
+            const auto wait_time = timeIt(start);
 
-    // Add the host-to-IPU copy program.
-    programs.push_back(copy_input);
+            const auto &options = configs[index];
+            auto &engine = *compiled.engine;
 
-    // Create a program to repeat the addition 100 times.
-    auto add_sequence = poplar::program::Sequence
-    {
-        poplar::program::Repeat(
-            100,
-            poplar::program::Execute(computeSet0)
-        ),
-    };
+            const unsigned num_workers_total = options.num_tiles * options.num_workers;
+            const auto dtype = options.dtype;
 
-    // Add the compute sets for our "algorithms".
-    programs.push_back(add_sequence);
-    programs.push_back(poplar::program::Execute(computeSet1));
-    programs.push_back(poplar::program::Execute(computeSet2));
+            std::cout << "\nBenchmarking " << num_ipus << " IPU(s), "
+                      << options.num_tiles / num_ipus << " tiles per IPU, width "
+                      << options.num_columns << ", " << options.num_repeats << " repeats"
+                      << (options.num_replicas > 1 ? ", replicated" : "") << "...\n";
 
-    // Add the IPU-to-host copy program.
-    programs.push_back(copy_output);
+            std::cout << "  " << (compiled.is_cached ? "Loaded cached program" : "Compiled")
+                      << " in " << compiled.compile_time << " ms, waited "
+                      << wait_time << " ms\n";
 
-    // Create a buffers to hold our input/output, zeroing the input buffer.
-    std::vector<int> buffer_in(num_workers_total);
-    std::vector<int> buffer_out(num_workers_total);
-    std::fill(buffer_in.begin(), buffer_in.end(), 0);
+            // Load the program on the device in the background. Meanwhile,
+            // record the previous run and prepare the host buffers, so that
+            // only the load itself is on the critical path.
+            auto loading = loadAsync(engine, device);
 
-    // Record start time.
-    auto start = std::chrono::steady_clock::now();
+            if (previous)
+            {
+                record(*previous);
+                previous.reset();
+            }
 
-    // Compile the graph program.
-    std::cout << "\nCompiling graph program...\n";
-    poplar::Engine engine(graph, programs);
-    std::cout << "  Took " << timeIt(start) << " ms\n";
+            // Create buffers to hold our input/output, zeroing the input
+            // buffer.
+            start = std::chrono::steady_clock::now();
+            std::vector<char> buffer_in(num_workers_total * typeSize(dtype));
+            std::vector<char> buffer_out(num_workers_total * typeSize(dtype));
+            fillBuffer(dtype, target, buffer_in.data(), num_workers_total, 0);
+            const auto prepare_time = timeIt(start);
 
-    // Load the program on the device.
-    std::cout << "Loading program on device...\n";
-    start = std::chrono::steady_clock::now();
-    engine.load(device);
-    std::cout << "  Took " << timeIt(start) << " ms\n";
+            const auto load_time = loading.get();
+            if (options.runtime_values)
+            {
+                writeValues(engine, options, target);
+            }
+            if (options.runtime_repeats)
+            {
+                writeRepeats(engine, options);
+            }
 
-    // Connect input/output data stream.
-    engine.connectStream("input_write", buffer_in.data());
-    engine.connectStream("output_read", buffer_out.data());
+            connectStreams(engine, options, buffer_in.data(), buffer_out.data());
 
-    // Run the host-to-IPU data stream copy.
-    std::cout << "Copying input data to IPU...\n";
-    start = std::chrono::steady_clock::now();
-    engine.run(Program::COPY_TO_IPU);
-    std::cout << "  Took " << timeIt(start) << " ms\n";
+            // Run each step, keeping the fastest host time and the maximum
+            // cycles per tile from the fastest iteration of each.
+            const auto num_phases = phase_names.size();
+            std::vector<double> host_times(num_phases, std::numeric_limits<double>::max());
+            std::vector<std::uint64_t> cycles(num_phases, std::numeric_limits<std::uint64_t>::max());
+            for (unsigned iteration=0; iteration<sweep.num_iterations; ++iteration)
+            {
+                for (unsigned i=0; i<num_phases; ++i)
+                {
+                    start = std::chrono::steady_clock::now();
+                    engine.run(Program::COPY_TO_IPU + i);
+                    host_times[i] = std::min(host_times[i], timeIt(start));
+
+                    const auto stats = readCycles(engine, phase_names[i] + "_cycles", options.num_tiles);
+                    cycles[i] = std::min(cycles[i], stats.max);
+                }
+            }
 
-    // Run add program.
-    std::cout << "Running repeat add program...\n";
-    start = std::chrono::steady_clock::now();
-    engine.run(Program::ADD_SOMETHING);
-    std::cout << "  Took " << timeIt(start) << " ms\n";
+            const auto compute_cycles = cycles[1] + cycles[2] + cycles[3];
+            std::cout << "  Load " << load_time << " ms, compute "
+                      << compute_cycles << " cycles ("
+                      << 1e3 * compute_cycles / clock_frequency << " ms)\n";
+
+            previous = Run{
+                index,
+                compiled.is_cached,
+                compiled.compile_time,
+                compiled.build.build_time,
+                wait_time,
+                load_time,
+                prepare_time,
+                std::move(host_times),
+                std::move(cycles),
+                std::move(buffer_out)
+            };
+        }
 
-    // Run multiply program.
-    std::cout << "Running multiply / clone program...\n";
-    start = std::chrono::steady_clock::now();
-    engine.run(Program::MULTIPLY_SOMETHING_NUM_TIMES);
-    std::cout << "  Took " << timeIt(start) << " ms\n";
+        if (previous)
+        {
+            record(*previous);
+        }
+    }
 
-    // Run sum program.
-    std::cout << "Running sum program...\n";
-    start = std::chrono::steady_clock::now();
-    engine.run(Program::SUM);
-    std::cout << "  Took " << timeIt(start) << " ms\n";
+    results.write(sweep.path);
+    std::cout << "\nWrote " << results.size() << " results to " << sweep.path << '\n';
 
-    // Run the IPU-to-host data stream copy.
-    std::cout << "Copying ouput data from IPU...\n";
-    start = std::chrono::steady_clock::now();
-    engine.run(Program::COPY_FROM_IPU);
-    std::cout << "  Took " << timeIt(start) << " ms\n";
+    // The configurations are built concurrently, so the peak memory is only
+    // known for the sweep as a whole.
+    std::cout << "Peak host RSS over the sweep " << peakRss() / (1024 * 1024) << " MB\n";
 
-    // Loop over the output buffer to validate the output.
-    std::cout << "Validating output...\n";
-    for (unsigned i=0; i<buffer_out.size(); ++i)
+    if (num_failed > 0)
     {
-        // Each value should be 5*100*10*20 = 100000.
-        assert(buffer_out[i] == 100000);
+        std::cerr << num_failed << " of " << results.size()
+                  << " configurations failed validation!\n";
+        return -1;
     }
 
     std::cout << "Done!\n";
@@ -354,22 +4020,13 @@ int main(int argc, char *argv[])
     return 0;
 }
 
-poplar::Device setIpuDevice(unsigned num_ipus)
+std::size_t peakRss()
 {
-    auto dm = poplar::DeviceManager::createDeviceManager();
-    auto hwDevices = dm.getDevices(poplar::TargetType::IPU, num_ipus);
-    if (hwDevices.size() > 0)
-    {
-        for (auto &d : hwDevices)
-        {
-            if (d.attach())
-            {
-                return std::move(d);
-            }
-        }
-    }
+    // The maximum resident set size is reported in kilobytes on Linux.
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
 
-    throw std::runtime_error("Unable to connect to IPU device!");
+    return std::size_t(usage.ru_maxrss) * 1024;
 }
 
 double timeIt(const std::chrono::time_point<std::chrono::steady_clock> &start)